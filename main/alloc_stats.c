@@ -0,0 +1,159 @@
+#include "alloc_stats.h"
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/task.h>
+#include <string.h>
+
+#include "sched.h"
+
+#if CONFIG_ALLOC_STATS
+
+#define ALLOC_STATS_PERIOD_MS 60000
+
+static const char* TAG = "alloc_stats";
+
+typedef struct {
+    TaskHandle_t task;  // NULL for allocations from an ISR
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t allocs;
+} entry_t;
+
+/* Filled in by the hooks, which run inside every malloc, free and their
+kin, from any task or ISR; a full table counts the rest as "other". */
+static entry_t entries[ALLOC_STATS_MAX_TASKS];
+static int entry_count = 0;
+static uint32_t other_allocs = 0;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Counts at the previous report, only touched by the scheduler job
+static uint32_t reported[ALLOC_STATS_MAX_TASKS];
+static uint32_t reported_other = 0;
+static bool booted = false;
+static uint32_t violations = 0;
+
+#if CONFIG_ALLOC_STATS_CHECK
+/* Tasks that allocate by design: Wi-Fi, lwIP, the default event loop that
+carries their events, and the MP3 decoder running in "Play Audio". */
+static const char* const exempt_tasks[] = {"wifi", "tiT", "sys_evt",
+                                           "Play Audio"};
+
+static bool is_exempt(const char* name) {
+    for (int i = 0; i < sizeof(exempt_tasks) / sizeof(exempt_tasks[0]); i++) {
+        if (strcmp(name, exempt_tasks[i]) == 0) return true;
+    }
+    return false;
+}
+#endif
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void* ptr, size_t size,
+                                         uint32_t caps) {
+    if (ptr == NULL) return;
+    TaskHandle_t task =
+        xPortInIsrContext() ? NULL : xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL_SAFE(&stats_mux);
+    int i = 0;
+    while (i < entry_count && entries[i].task != task) i++;
+    if (i == entry_count && entry_count < ALLOC_STATS_MAX_TASKS) {
+        // Named now, since the task may be gone by the time it is reported
+        const char* name = task != NULL ? pcTaskGetName(task) : "ISR";
+        int n = 0;
+        while (n < configMAX_TASK_NAME_LEN - 1 && name[n] != '\0') {
+            entries[i].name[n] = name[n];
+            n++;
+        }
+        entries[i].name[n] = '\0';
+        entries[i].task = task;
+        entry_count++;
+    }
+    if (i < entry_count) {
+        entries[i].allocs++;
+    } else {
+        other_allocs++;
+    }
+    portEXIT_CRITICAL_SAFE(&stats_mux);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void* ptr) {}
+
+/* Log the allocations of the last period, per task. The first period
+covers boot and is only a baseline; with CONFIG_ALLOC_STATS_CHECK any later
+allocation by a task not in exempt_tasks is an error. */
+static void report(void* arg) {
+    entry_t snapshot[ALLOC_STATS_MAX_TASKS];
+    portENTER_CRITICAL(&stats_mux);
+    int n = entry_count;
+    memcpy(snapshot, entries, n * sizeof(entry_t));
+    uint32_t other = other_allocs;
+    portEXIT_CRITICAL(&stats_mux);
+
+    uint32_t total = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t delta = snapshot[i].allocs - reported[i];
+        reported[i] = snapshot[i].allocs;
+        total += delta;
+        if (!booted || delta == 0) continue;
+#if CONFIG_ALLOC_STATS_CHECK
+        if (!is_exempt(snapshot[i].name)) {
+            ESP_LOGE(TAG, "%s: %u allocations after boot", snapshot[i].name,
+                     (unsigned int)delta);
+            violations += delta;
+            continue;
+        }
+#endif
+        ESP_LOGI(TAG, "%s: %u allocations", snapshot[i].name,
+                 (unsigned int)delta);
+    }
+    total += other - reported_other;
+    reported_other = other;
+
+    if (!booted) {
+        ESP_LOGI(TAG, "%u allocations during boot", (unsigned int)total);
+        booted = true;
+    } else if (total == 0) {
+        ESP_LOGI(TAG, "No allocations in the last minute");
+    } else {
+#if CONFIG_STATIC_ALLOC
+        ESP_LOGW(TAG, "%u allocations in the last minute", (unsigned int)total);
+#else
+        ESP_LOGI(TAG, "%u allocations in the last minute", (unsigned int)total);
+#endif
+    }
+}
+
+static sched_job_t report_job = SCHED_JOB_INIT(report, NULL);
+
+void alloc_stats_init(void) {
+    sched_every(&report_job, ALLOC_STATS_PERIOD_MS);
+}
+
+int alloc_stats_get(alloc_stats_task_t* out, int max) {
+    portENTER_CRITICAL(&stats_mux);
+    int n = entry_count < max ? entry_count : max;
+    for (int i = 0; i < n; i++) {
+        memcpy(out[i].name, entries[i].name, sizeof(out[i].name));
+        out[i].allocs = entries[i].allocs;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+    return n;
+}
+
+uint32_t alloc_stats_violations(void) {
+    return violations;
+}
+
+#else
+
+void alloc_stats_init(void) {}
+
+int alloc_stats_get(alloc_stats_task_t* out, int max) {
+    return 0;
+}
+
+uint32_t alloc_stats_violations(void) {
+    return 0;
+}
+
+#endif
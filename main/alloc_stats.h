@@ -0,0 +1,24 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <freertos/FreeRTOS.h>
+#include <stdint.h>
+
+#define ALLOC_STATS_MAX_TASKS 24
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t allocs;  // Since boot
+} alloc_stats_task_t;
+
+/* Heap allocation counts per task, from the heap hooks of
+CONFIG_ALLOC_STATS. alloc_stats_init logs the counts of every minute after
+boot, which should stay at zero with CONFIG_STATIC_ALLOC apart from Wi-Fi,
+lwIP and the MP3 decoder; alloc_stats_get copies them out for /metrics.
+alloc_stats_violations counts the allocations that CONFIG_ALLOC_STATS_CHECK
+flagged as errors. */
+void alloc_stats_init(void);
+int alloc_stats_get(alloc_stats_task_t* out, int max);
+uint32_t alloc_stats_violations(void);
+
+#endif /* ALLOC_STATS_H */
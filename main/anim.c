@@ -0,0 +1,89 @@
+#include "anim.h"
+
+#include <esp_log.h>
+#include <stddef.h>
+
+static const char* TAG = "anim";
+
+typedef struct {
+    const anim_effect_t* fx;
+    anim_cel_t cel;
+    uint32_t frame;
+    int64_t next_us;
+} anim_slot_t;
+
+static anim_slot_t slots[ANIM_LAYERS];
+
+bool anim_start(const anim_effect_t* fx, int64_t now_us) {
+    anim_slot_t* slot = &slots[fx->layer];
+
+    if (slot->fx != NULL && slot->fx->priority > fx->priority) {
+        ESP_LOGI(TAG, "%s rejected, %s is running", fx->name,
+                 slot->fx->name);
+        return false;
+    }
+    if (slot->fx != NULL) {
+        ESP_LOGI(TAG, "%s preempts %s", fx->name, slot->fx->name);
+    }
+
+    if (fx->start) fx->start();
+    slot->fx = fx;
+    slot->cel = (anim_cel_t){0};
+    slot->frame = 0;
+    slot->next_us = now_us;
+    return true;
+}
+
+void anim_cancel(anim_layer_t layer) {
+    slots[layer].fx = NULL;
+}
+
+void anim_cancel_all(void) {
+    for (int l = 0; l < ANIM_LAYERS; l++) {
+        anim_cancel(l);
+    }
+}
+
+bool anim_active(void) {
+    for (int l = 0; l < ANIM_LAYERS; l++) {
+        if (slots[l].fx != NULL) return true;
+    }
+    return false;
+}
+
+/* Advance every effect whose next frame is due. A late tick renders one frame
+and moves on rather than replaying the frames it missed. Returns true while
+any effect is still running. */
+bool anim_step(int64_t now_us) {
+    bool active = false;
+
+    for (int l = 0; l < ANIM_LAYERS; l++) {
+        anim_slot_t* slot = &slots[l];
+        if (slot->fx == NULL) continue;
+
+        if (now_us >= slot->next_us) {
+            if (!slot->fx->step(slot->frame, &slot->cel)) {
+                slot->fx = NULL;
+                continue;
+            }
+            slot->frame++;
+            slot->next_us += (int64_t)slot->fx->period_ms * 1000;
+            if (slot->next_us < now_us) {
+                slot->next_us = now_us + (int64_t)slot->fx->period_ms * 1000;
+            }
+        }
+        active = true;
+    }
+
+    return active;
+}
+
+/* Stack the running effects' cels over the base (time) frame. */
+uint64_t anim_compose(uint64_t base) {
+    uint64_t frame = base;
+    for (int l = 0; l < ANIM_LAYERS; l++) {
+        if (slots[l].fx == NULL) continue;
+        frame = (frame & ~slots[l].cel.cover) | slots[l].cel.bits;
+    }
+    return frame;
+}
@@ -0,0 +1,49 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Engine tick; every effect period is rounded up to a multiple of this
+#define ANIM_TICK_MS 10
+
+/* Frame compositor. The display task owns the engine: effects are started,
+stepped and composited only from there, so nothing here blocks or locks.
+
+Layers are stacked bottom to top. The time layer is the base frame passed to
+anim_compose(); each running effect contributes a cel whose `cover` bits hide
+whatever lies beneath them (typically whole tubes, see display_tube_cover).
+
+Preemption: each layer runs at most one effect. Starting an effect on a busy
+layer replaces the running one if its priority is greater or equal, and is
+rejected otherwise. Cancelling a layer drops its cel immediately. */
+typedef enum {
+    ANIM_LAYER_TRANSITION,  // Replaces the time while it changes
+    ANIM_LAYER_OVERLAY,     // Short-lived information drawn over everything
+    ANIM_LAYERS
+} anim_layer_t;
+
+typedef struct {
+    uint64_t bits;   // Cathodes and colons lit by this layer
+    uint64_t cover;  // Bits this layer owns; lower layers show elsewhere
+} anim_cel_t;
+
+typedef struct {
+    const char* name;
+    anim_layer_t layer;
+    uint8_t priority;
+    uint32_t period_ms;
+    // Optional: reset effect state before frame 0
+    void (*start)(void);
+    // Render frame number `frame` into `cel`; return false when finished
+    bool (*step)(uint32_t frame, anim_cel_t* cel);
+} anim_effect_t;
+
+bool anim_start(const anim_effect_t* fx, int64_t now_us);
+void anim_cancel(anim_layer_t layer);
+void anim_cancel_all(void);
+bool anim_active(void);
+bool anim_step(int64_t now_us);
+uint64_t anim_compose(uint64_t base);
+
+#endif /* ANIM_H */
@@ -15,6 +15,8 @@
 #include <freertos/task.h>
 #include <stdio.h>
 
+#include "trace.h"
+
 static const char* TAG = "audio";
 
 static i2s_chan_handle_t i2s_tx_chan = NULL;
@@ -155,8 +157,10 @@ static esp_err_t audio_write(void* audio_buffer, size_t len,
         return ESP_FAIL;
     }
 
+    TRACE_BEGIN("i2s write");
     esp_err_t ret = i2s_channel_write(i2s_tx_chan, audio_buffer, len,
                                       bytes_written, timeout_ms);
+    TRACE_END("i2s write");
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "audio_write: i2s_channel_write failed: %s",
                  esp_err_to_name(ret));
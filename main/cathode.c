@@ -0,0 +1,147 @@
+#include "cathode.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <nvs.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CATHODE_NVS_NAMESPACE "cathode"
+#define CATHODE_NVS_KEY "on_s"
+#define CATHODE_SLICE_STEPS (CONFIG_CATHODE_SLICE_MS / CONFIG_CATHODE_STEP_MS)
+
+static const char* TAG = "cathode";
+
+/* On-time per cathode, in whole seconds plus a millisecond remainder. Only
+the seconds are persisted; losing up to a second per cathode across a
+reboot does not matter for wear levelling. */
+static uint32_t on_s[DISPLAY_TUBES][CATHODE_DIGITS];
+static uint16_t on_ms[DISPLAY_TUBES][CATHODE_DIGITS];
+static portMUX_TYPE on_time_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool dirty = false;
+static int64_t last_save_us = 0;
+
+// Exercise order per tube, least-used cathode first
+static uint8_t exercise_order[DISPLAY_TUBES][CATHODE_DIGITS];
+
+void cathode_init(void) {
+    nvs_handle_t handle;
+    if (nvs_open(CATHODE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "No saved cathode counters, starting from zero");
+        return;
+    }
+
+    size_t size = sizeof(on_s);
+    if (nvs_get_blob(handle, CATHODE_NVS_KEY, on_s, &size) != ESP_OK ||
+        size != sizeof(on_s)) {
+        ESP_LOGW(TAG, "Saved cathode counters unreadable, starting from zero");
+        memset(on_s, 0, sizeof(on_s));
+    }
+    nvs_close(handle);
+    last_save_us = esp_timer_get_time();
+}
+
+/* Credit `elapsed_ms` to every cathode lit in `frame`. Called by the display
+layer when the visible frame changes. */
+void cathode_account(uint64_t frame, uint32_t elapsed_ms) {
+    if (elapsed_ms == 0) return;
+
+    portENTER_CRITICAL(&on_time_mux);
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        if ((frame & display_tube_cover[t]) == 0) continue;
+        for (int d = 0; d < CATHODE_DIGITS; d++) {
+            if (frame & display_digit_mask[t][d]) {
+                uint32_t ms = on_ms[t][d] + elapsed_ms;
+                on_s[t][d] += ms / 1000;
+                on_ms[t][d] = ms % 1000;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&on_time_mux);
+    dirty = true;
+}
+
+// Kept open between saves, as every nvs_open allocates
+static nvs_handle_t save_handle = 0;
+
+static esp_err_t open_for_save(void) {
+    if (save_handle != 0) return ESP_OK;
+    esp_err_t ret =
+        nvs_open(CATHODE_NVS_NAMESPACE, NVS_READWRITE, &save_handle);
+    if (ret != ESP_OK) save_handle = 0;
+    return ret;
+}
+
+/* Persist the counters at most every CONFIG_CATHODE_SAVE_INTERVAL_H hours to
+keep flash wear negligible. */
+void cathode_save_if_due(void) {
+    int64_t now = esp_timer_get_time();
+    if (!dirty || now - last_save_us <
+                      (int64_t)CONFIG_CATHODE_SAVE_INTERVAL_H * 3600000000LL) {
+        return;
+    }
+    last_save_us = now;
+
+    uint32_t snapshot[DISPLAY_TUBES][CATHODE_DIGITS];
+    cathode_get_on_time(snapshot);
+
+    esp_err_t ret = open_for_save();
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(save_handle, CATHODE_NVS_KEY, snapshot,
+                           sizeof(snapshot));
+        if (ret == ESP_OK) ret = nvs_commit(save_handle);
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save cathode counters (%s)",
+                 esp_err_to_name(ret));
+        return;
+    }
+    dirty = false;
+    ESP_LOGI(TAG, "Cathode counters saved");
+}
+
+void cathode_get_on_time(uint32_t out[DISPLAY_TUBES][CATHODE_DIGITS]) {
+    portENTER_CRITICAL(&on_time_mux);
+    memcpy(out, on_s, sizeof(on_s));
+    portEXIT_CRITICAL(&on_time_mux);
+}
+
+static void exercise_start(void) {
+    uint32_t snapshot[DISPLAY_TUBES][CATHODE_DIGITS];
+    cathode_get_on_time(snapshot);
+
+    // Insertion sort of ten digits per tube by on-time
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        for (int d = 0; d < CATHODE_DIGITS; d++) {
+            int i = d;
+            while (i > 0 &&
+                   snapshot[t][exercise_order[t][i - 1]] > snapshot[t][d]) {
+                exercise_order[t][i] = exercise_order[t][i - 1];
+                i--;
+            }
+            exercise_order[t][i] = d;
+        }
+    }
+}
+
+static bool exercise_step(uint32_t frame, anim_cel_t* cel) {
+    if (frame >= CATHODE_SLICE_STEPS) return false;
+
+    uint8_t digits[DISPLAY_TUBES];
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        digits[t] = exercise_order[t][frame % CATHODE_DIGITS];
+    }
+    cel->bits = display_compose(digits, 0);
+    cel->cover = DISPLAY_ALL & ~DISPLAY_COLONS;
+    return true;
+}
+
+const anim_effect_t cathode_exercise_fx = {.name = "cathode exercise",
+                                           .layer = ANIM_LAYER_TRANSITION,
+                                           .priority = 0,
+                                           .period_ms = CONFIG_CATHODE_STEP_MS,
+                                           .start = exercise_start,
+                                           .step = exercise_step};
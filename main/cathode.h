@@ -0,0 +1,20 @@
+#ifndef CATHODE_H
+#define CATHODE_H
+
+#include <stdint.h>
+
+#include "anim.h"
+#include "display.h"
+
+#define CATHODE_DIGITS 10
+
+void cathode_init(void);
+void cathode_account(uint64_t frame, uint32_t elapsed_ms);
+void cathode_save_if_due(void);
+void cathode_get_on_time(uint32_t on_s[DISPLAY_TUBES][CATHODE_DIGITS]);
+
+// Anti-poisoning slice: lights the least-used cathodes of every tube in turn
+// for CONFIG_CATHODE_SLICE_MS, then hands the tubes back to the time.
+extern const anim_effect_t cathode_exercise_fx;
+
+#endif /* CATHODE_H */
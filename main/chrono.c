@@ -0,0 +1,109 @@
+#include "chrono.h"
+
+#include <string.h>
+
+#include "display.h"
+
+#define CS_PER_HOUR (3600 * 100)
+#define CHRONO_MAX_CS (100 * CS_PER_HOUR - 1)  // 99:59:59.99
+#define CHRONO_MAX_COUNTDOWN_S (100 * 3600 - 1)
+
+static chrono_mode_t mode = CHRONO_OFF;
+static bool running = false;
+static int64_t run_start_us = 0;  // Start of the current run
+static uint32_t banked_cs = 0;    // Elapsed before the current run
+static uint32_t length_cs = 0;    // Countdown length
+
+static const char* const cmd_names[] = {
+    [CHRONO_CMD_STOPWATCH] = "stopwatch", [CHRONO_CMD_COUNTDOWN] = "countdown",
+    [CHRONO_CMD_START] = "start",         [CHRONO_CMD_STOP] = "stop",
+    [CHRONO_CMD_RESET] = "reset",         [CHRONO_CMD_EXIT] = "exit"};
+
+void chrono_set_mode(chrono_mode_t new_mode, uint32_t countdown_s) {
+    if (countdown_s > CHRONO_MAX_COUNTDOWN_S) {
+        countdown_s = CHRONO_MAX_COUNTDOWN_S;
+    }
+    mode = new_mode;
+    length_cs = countdown_s * 100;
+    chrono_reset();
+}
+
+chrono_mode_t chrono_mode(void) {
+    return mode;
+}
+
+bool chrono_running(void) {
+    return running;
+}
+
+static uint32_t elapsed_cs(int64_t now_us) {
+    uint64_t cs = banked_cs;
+    if (running) {
+        cs += (uint64_t)(now_us - run_start_us) / (CHRONO_TICK_MS * 1000);
+    }
+    return (cs > CHRONO_MAX_CS) ? CHRONO_MAX_CS : (uint32_t)cs;
+}
+
+/* Start or resume at `now_us`. Elapsed time is banked in whole hundredths,
+so value changes fall exactly on multiples of CHRONO_TICK_MS from the start
+of the run; a periodic timer started now ticks on every one of them. Returns
+false if there is nothing to run. */
+bool chrono_start(int64_t now_us) {
+    if (mode == CHRONO_OFF || running) return false;
+    if (mode == CHRONO_COUNTDOWN && chrono_value(now_us) == 0) return false;
+
+    run_start_us = now_us;
+    running = true;
+    return true;
+}
+
+void chrono_stop(int64_t now_us) {
+    if (!running) return;
+    banked_cs = elapsed_cs(now_us);
+    running = false;
+}
+
+void chrono_reset(void) {
+    running = false;
+    banked_cs = 0;
+}
+
+/* Hundredths on display at `now_us`: elapsed for the stopwatch, remaining
+for the countdown. */
+uint32_t chrono_value(int64_t now_us) {
+    uint32_t cs = elapsed_cs(now_us);
+    if (mode == CHRONO_COUNTDOWN) {
+        return (cs < length_cs) ? length_cs - cs : 0;
+    }
+    return cs;
+}
+
+/* MM:SS.cc below an hour, HH:MM:SS from there on. */
+uint64_t chrono_frame(uint32_t value) {
+    uint32_t s = value / 100;
+    uint32_t hi, mid, lo;
+
+    if (value < CS_PER_HOUR) {
+        hi = s / 60;
+        mid = s % 60;
+        lo = value % 100;
+    } else {
+        hi = s / 3600;
+        mid = (s / 60) % 60;
+        lo = s % 60;
+    }
+
+    const uint8_t digits[DISPLAY_TUBES] = {hi / 10,  hi % 10, mid / 10,
+                                           mid % 10, lo / 10, lo % 10};
+    return display_compose(digits, DISPLAY_COLONS);
+}
+
+bool chrono_cmd_from_string(const char* name, chrono_cmd_t* cmd) {
+    for (int i = 0; i < sizeof(cmd_names) / sizeof(cmd_names[0]); i++) {
+        if (strcmp(name, cmd_names[i]) == 0) {
+            *cmd = (chrono_cmd_t)i;
+            return true;
+        }
+    }
+    return false;
+}
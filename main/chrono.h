@@ -0,0 +1,33 @@
+#ifndef CHRONO_H
+#define CHRONO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Display refresh while running: one frame per hundredth of a second
+#define CHRONO_TICK_MS 10
+
+typedef enum { CHRONO_OFF, CHRONO_STOPWATCH, CHRONO_COUNTDOWN } chrono_mode_t;
+
+typedef enum {
+    CHRONO_CMD_STOPWATCH,  // Enter stopwatch mode, reset to zero
+    CHRONO_CMD_COUNTDOWN,  // Enter countdown mode, reset to the given length
+    CHRONO_CMD_START,
+    CHRONO_CMD_STOP,
+    CHRONO_CMD_RESET,
+    CHRONO_CMD_EXIT  // Back to the clock
+} chrono_cmd_t;
+
+/* Stopwatch and countdown state. Times are kept in hundredths of a second;
+only the display task calls into here, so nothing is locked. */
+void chrono_set_mode(chrono_mode_t mode, uint32_t countdown_s);
+chrono_mode_t chrono_mode(void);
+bool chrono_running(void);
+bool chrono_start(int64_t now_us);
+void chrono_stop(int64_t now_us);
+void chrono_reset(void);
+uint32_t chrono_value(int64_t now_us);
+uint64_t chrono_frame(uint32_t value);
+bool chrono_cmd_from_string(const char* name, chrono_cmd_t* cmd);
+
+#endif /* CHRONO_H */
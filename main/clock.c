@@ -1,8 +1,9 @@
 #include "clock.h"
 
 #include <driver/gpio.h>
+#include <esp_cpu.h>
 #include <esp_log.h>
-#include <esp_random.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
@@ -10,24 +11,98 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
-#include "config.h"
+#include "anim.h"
+#include "cathode.h"
+#include "dimmer.h"
+#include "display.h"
+#include "dither.h"
 #include "leds.h"
+#include "reel.h"
+#include "settings.h"
+#include "static_alloc.h"
+#include "timekeep.h"
+#include "wallclock.h"
 
 extern TaskHandle_t play_audio_task_handle;
 static const char* TAG = "clock";
 static int ram_time_fmt = 1;  // Default to 24h
+static int ram_colon = 2;     // 2: Blinking, 1: On, 0: Off
+static int ram_fade = 0;      // Digit crossfade in ms, 0: hard switch
+
+// Minimum time before a second edge needed to preload the next frame
+#define EDGE_MIN_LEAD_US 5000
+
+#define CLOCK_FADE_MAX_MS 900
+
+// Stopwatch/countdown cost is logged every this many ticks (10 s)
+#define CHRONO_REPORT_TICKS 1000
 
 // Display Queue System (Single Hardware Owner Model)
-typedef enum { DISP_CMD_SHOW_TIME, DISP_CMD_SLOT_MACHINE } disp_cmd_type_t;
+typedef enum {
+    DISP_CMD_SHOW_TIME,
+    DISP_CMD_SLOT_MACHINE,
+    DISP_CMD_SECOND_EDGE,
+    DISP_CMD_FRAME,
+    DISP_CMD_CHRONO,
+    DISP_CMD_CHRONO_TICK
+} disp_cmd_type_t;
 
 typedef struct {
     disp_cmd_type_t type;
+    uint8_t sub;   // CHRONO: chrono_cmd_t; CHRONO_TICK: frame was latched
+    uint32_t arg;  // CHRONO: countdown length in s; CHRONO_TICK: latch cycles
 } disp_msg_t;
 
 static QueueHandle_t disp_queue = NULL;
 
+// Second Edge Timer
+// The frame for the coming second is shifted in ahead of time and only the
+// latch pulse is issued from the timer, on the wall-clock second boundary.
+static esp_timer_handle_t edge_timer = NULL;
+static int64_t edge_target_us = 0;  // esp_timer time of the scheduled edge
+static struct tm edge_tm;           // Time shown from that edge on
+
+// Latch latency past the scheduled edge, in microseconds
+static portMUX_TYPE edge_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static int32_t edge_late_min = INT32_MAX;
+static int32_t edge_late_max = 0;
+static int64_t edge_late_sum = 0;
+static uint32_t edge_count = 0;
+
+// Animation Frame Timer
+// Runs only while an effect is active. The time layer then follows the
+// seconds at frame resolution and the edge timer is parked.
+static esp_timer_handle_t frame_timer = NULL;
+static volatile bool frame_pending = false;
+
+// Digit Crossfade
+// With a crossfade the edge timer only marks the second; the old and new
+// frames are then dithered on the frame timer for ram_fade ms.
+static bool fade_active = false;
+static uint64_t fade_from = 0;
+static uint64_t fade_to = 0;
+static int64_t fade_start_us = 0;
+
+// Stopwatch / Countdown Timer
+// While running, the frame for the next hundredth is preloaded after every
+// tick and latched by the following tick from ISR context, so each value
+// appears exactly on its boundary.
+static esp_timer_handle_t chrono_timer = NULL;
+static bool chrono_preloaded = false;  // The coming tick has a frame to latch
+static uint32_t chrono_next = 0;       // Value preloaded for that tick
+static uint32_t chrono_shown = 0;      // Value on the tubes
+
+// Cost of the 100 Hz path over the current report window
+static uint32_t chrono_ticks = 0;
+static uint32_t chrono_missed = 0;
+static uint32_t chrono_latched = 0;
+static uint64_t chrono_latch_cycles = 0;
+static uint64_t chrono_shift_cycles = 0;
+static uint32_t chrono_shift_max = 0;
+
 // Shift Register Logic
 uint32_t hours = 0;
 uint32_t minutes = 0;
@@ -38,97 +113,387 @@ void clock_set_ram_format(int fmt) {
     ESP_LOGI(TAG, "Format updated: %s", (fmt == 0) ? "12h" : "24h");
 }
 
-void shift_out_data(uint64_t data) {
-    for (int i = 63; i >= 0; i--) {
-        gpio_set_level(DATA_PIN, (data >> i) & 0x01);
-        gpio_set_level(CLOCK_PIN, 1);
-        esp_rom_delay_us(2);
-        gpio_set_level(CLOCK_PIN, 0);
-        esp_rom_delay_us(2);
+void clock_set_ram_colon(int mode) {
+    ram_colon = mode;
+    ESP_LOGI(TAG, "Colon updated: %s",
+             (mode == 0) ? "off" : (mode == 1) ? "on" : "blinking");
+}
+
+void clock_set_ram_fade(int ms) {
+    // Must be over well before the next second edge
+    ram_fade = (ms < 0) ? 0 : (ms > CLOCK_FADE_MAX_MS) ? CLOCK_FADE_MAX_MS : ms;
+    ESP_LOGI(TAG, "Crossfade updated: %d ms", ram_fade);
+}
+
+static void apply_settings(const settings_t* s, uint32_t changed) {
+    clock_set_ram_format(s->clock.time_fmt);
+    clock_set_ram_colon(s->clock.colon);
+    clock_set_ram_fade(s->clock.fade_ms);
+}
+
+static bool fade_enabled(void) {
+#if CONFIG_DITHER
+    return ram_fade > 0;
+#else
+    return false;
+#endif
+}
+
+static void time_digits(const struct tm* timeinfo,
+                        uint8_t digits[DISPLAY_TUBES]) {
+    hours = timeinfo->tm_hour;
+    minutes = timeinfo->tm_min;
+    seconds = timeinfo->tm_sec;
+
+    if (ram_time_fmt == 0) {
+        hours %= 12;
+        if (hours == 0) hours = 12;
     }
+
+    digits[0] = hours / 10;
+    digits[1] = hours % 10;
+    digits[2] = minutes / 10;
+    digits[3] = minutes % 10;
+    digits[4] = seconds / 10;
+    digits[5] = seconds % 10;
 }
 
-uint64_t set_bit(uint64_t num, int pos) {
-    return num | ((uint64_t)1 << pos);
+static uint64_t time_frame(const struct tm* timeinfo) {
+    uint8_t digits[DISPLAY_TUBES];
+    time_digits(timeinfo, digits);
+
+    // Blinking colons follow the seconds, so they change on the same edge
+    bool dots = (ram_colon == 1) || (ram_colon == 2 && seconds % 2 == 0);
+    return display_compose(digits, dots ? DISPLAY_COLONS : 0);
 }
 
-uint64_t set_HH(uint64_t num, uint32_t HH) {
-    static const int map[] = {7, 6, 5, 4, 3, 2, 1, 0, 15, 14};
-    return (HH < 10) ? set_bit(num, 63 - map[HH]) : num;
+static uint64_t current_time_frame(void) {
+    static time_t cached_sec = -1;
+    static uint64_t cached_frame = 0;
+    time_t now;
+    struct tm timeinfo;
+
+    time(&now);
+    if (now != cached_sec) {
+        wallclock_at(now, &timeinfo);
+        cached_frame = time_frame(&timeinfo);
+        cached_sec = now;
+    }
+    return cached_frame;
 }
-uint64_t set_H(uint64_t num, uint32_t H) {
-    static const int map[] = {13, 12, 11, 10, 9, 8, 23, 22, 21, 20};
-    return (H < 10) ? set_bit(num, 63 - map[H]) : num;
+
+static void update_shift_registers(void) {
+    display_show(anim_compose(current_time_frame()));
 }
-uint64_t set_MM(uint64_t num, uint32_t MM) {
-    static const int map[] = {17, 16, 31, 30, 29, 28, 27, 26, 25, 24};
-    return (MM < 10) ? set_bit(num, 63 - map[MM]) : num;
+
+static void IRAM_ATTR post_from_isr(const disp_msg_t* msg) {
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(disp_queue, msg, &woken);
+    if (woken) esp_timer_isr_dispatch_need_yield();
+#else
+    xQueueSend(disp_queue, msg, 0);
+#endif
 }
-uint64_t set_M(uint64_t num, uint32_t M) {
-    static const int map[] = {39, 38, 37, 36, 35, 34, 33, 32, 47, 46};
-    return (M < 10) ? set_bit(num, 63 - map[M]) : num;
+
+static void IRAM_ATTR second_edge_cb(void* arg) {
+    int64_t now = esp_timer_get_time();
+    display_latch();
+
+    int32_t late = (int32_t)(now - edge_target_us);
+    portENTER_CRITICAL_ISR(&edge_stats_mux);
+    if (late < edge_late_min) edge_late_min = late;
+    if (late > edge_late_max) edge_late_max = late;
+    edge_late_sum += late;
+    edge_count++;
+    portEXIT_CRITICAL_ISR(&edge_stats_mux);
+
+    disp_msg_t msg = {.type = DISP_CMD_SECOND_EDGE};
+    post_from_isr(&msg);
 }
-uint64_t set_SS(uint64_t num, uint32_t SS) {
-    static const int map[] = {43, 42, 41, 40, 55, 54, 53, 52, 51, 50};
-    return (SS < 10) ? set_bit(num, 63 - map[SS]) : num;
+
+/* Preload the frame for the coming second and arm the timer that latches it
+on the second boundary. When crossfading, or when the frame has to be
+dithered, nothing is preloaded and the display task shows it on the edge. */
+static void schedule_second_edge(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    int64_t delay_us = 1000000 - tv.tv_usec;
+    time_t next = tv.tv_sec + 1;
+
+    esp_timer_stop(edge_timer);
+
+    if (delay_us < EDGE_MIN_LEAD_US) {
+        // Too close to preload safely: show it a few ms early instead
+        wallclock_at(next, &edge_tm);
+        display_show(time_frame(&edge_tm));
+        delay_us += 1000000;
+        next++;
+    }
+
+    wallclock_at(next, &edge_tm);
+    if (!fade_enabled()) {
+        display_preload(time_frame(&edge_tm));
+    }
+
+    edge_target_us = esp_timer_get_time() + delay_us;
+    esp_timer_start_once(edge_timer, delay_us);
 }
-uint64_t set_S(uint64_t num, uint32_t S) {
-    static const int map[] = {49, 48, 63, 62, 61, 60, 59, 58, 57, 56};
-    return (S < 10) ? set_bit(num, 63 - map[S]) : num;
+
+/* Log the latch latency once a minute and start a new window. */
+static void report_edge_stats(void) {
+    if (edge_tm.tm_sec != 0) return;
+
+    portENTER_CRITICAL(&edge_stats_mux);
+    int32_t late_min = edge_late_min;
+    int32_t late_max = edge_late_max;
+    int64_t late_sum = edge_late_sum;
+    uint32_t count = edge_count;
+    edge_late_min = INT32_MAX;
+    edge_late_max = 0;
+    edge_late_sum = 0;
+    edge_count = 0;
+    portEXIT_CRITICAL(&edge_stats_mux);
+
+    if (count == 0) return;
+
+    ESP_LOGI(TAG,
+             "Second edge latch latency over %u edges: avg %d us, min %d us, "
+             "max %d us, jitter %d us",
+             (unsigned int)count, (int)(late_sum / count), (int)late_min,
+             (int)late_max, (int)(late_max - late_min));
 }
 
-void update_tubes(uint32_t HH, uint32_t H, uint32_t MM, uint32_t M, uint32_t SS,
-                  uint32_t S, bool show_dots) {
-    uint64_t num = 0;
+static void frame_timer_cb(void* arg) {
+    // One frame request in the queue is enough; keep room for commands
+    if (frame_pending) return;
+    frame_pending = true;
+    disp_msg_t msg = {.type = DISP_CMD_FRAME};
+    if (xQueueSend(disp_queue, &msg, 0) != pdTRUE) {
+        frame_pending = false;
+    }
+}
 
-    num = set_HH(num, HH);
-    num = set_H(num, H);
-    num = set_MM(num, MM);
-    num = set_M(num, M);
-    num = set_SS(num, SS);
-    num = set_S(num, S);
+static void render_frame(void) {
+    int64_t now = esp_timer_get_time();
+    bool running = anim_step(now);
 
-    if (show_dots) {
-        num = set_bit(num, 18);
-        num = set_bit(num, 19);
-        num = set_bit(num, 44);
-        num = set_bit(num, 45);
+    if (fade_active) {
+        int32_t elapsed_ms = (int32_t)((now - fade_start_us) / 1000);
+        if (elapsed_ms < ram_fade) {
+            display_fade(fade_from, fade_to,
+                         elapsed_ms * DITHER_SLOTS / ram_fade);
+            return;
+        }
+        fade_active = false;
     }
+    update_shift_registers();
 
-    shift_out_data(num);
-    gpio_set_level(LATCH_PIN, 1);
-    esp_rom_delay_us(5);
-    gpio_set_level(LATCH_PIN, 0);
+    if (!running) {
+        // Last effect finished: hand the display back to the second edge
+        esp_timer_stop(frame_timer);
+        schedule_second_edge();
+    }
 }
 
-static void update_shift_registers(void) {
-    time_t now;
-    struct tm timeinfo;
+static void start_effect(const anim_effect_t* fx) {
+    if (!anim_start(fx, esp_timer_get_time())) return;
 
-    time(&now);
-    localtime_r(&now, &timeinfo);
+    // An effect takes over from a crossfade in progress
+    fade_active = false;
 
-    hours = timeinfo.tm_hour;
-    minutes = timeinfo.tm_min;
-    seconds = timeinfo.tm_sec;
+    if (!esp_timer_is_active(frame_timer)) {
+        // The preloaded frame must not be latched over the effect
+        esp_timer_stop(edge_timer);
+        esp_timer_start_periodic(frame_timer, ANIM_TICK_MS * 1000);
+    }
+    render_frame();
+}
 
-    if (ram_time_fmt == 0) {
-        hours %= 12;
-        if (hours == 0) hours = 12;
+/* Crossfade from the frame on the tubes to `to`, on the frame timer. */
+static void start_fade(uint64_t to) {
+    fade_from = display_current();
+    fade_to = to;
+    fade_start_us = esp_timer_get_time();
+    fade_active = true;
+
+    if (!esp_timer_is_active(frame_timer)) {
+        esp_timer_start_periodic(frame_timer, ANIM_TICK_MS * 1000);
+    }
+    render_frame();
+}
+
+/* Spin the reels so that every tube lands on the digit the time will have
+when it stops. */
+static void start_slot_machine(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    uint8_t targets[DISPLAY_TUBES];
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        time_t land = (now_ms + reel_land_ms(t)) / 1000;
+        struct tm land_tm;
+        uint8_t digits[DISPLAY_TUBES];
+        wallclock_at(land, &land_tm);
+        time_digits(&land_tm, digits);
+        targets[t] = digits[t];
     }
+    reel_set_targets(targets);
+    start_effect(&reel_slot_fx);
+}
+
+/* Anti-poisoning slices run at the top of every
+CONFIG_CATHODE_SLICE_INTERVAL_MIN minutes, except on the hour, which belongs
+to the slot machine. */
+static bool cathode_slice_due(void) {
+#if CONFIG_CATHODE_SLICE_MS > 0
+    return edge_tm.tm_sec == 0 && edge_tm.tm_min != 0 &&
+           edge_tm.tm_min % CONFIG_CATHODE_SLICE_INTERVAL_MIN == 0;
+#else
+    return false;
+#endif
+}
+
+/* Back to the time from whatever the display was doing. */
+static void show_time(void) {
+    anim_cancel_all();
+    fade_active = false;
+    esp_timer_stop(chrono_timer);
+    chrono_set_mode(CHRONO_OFF, 0);
+    esp_timer_stop(frame_timer);
+    esp_timer_stop(edge_timer);
+    update_shift_registers();
+    schedule_second_edge();
+}
 
-    bool dots = (seconds % 2 == 0);
+static void IRAM_ATTR chrono_tick_cb(void* arg) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    bool latched = display_latch();
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
 
-    update_tubes((hours / 10), (hours % 10), (minutes / 10), (minutes % 10),
-                 (seconds / 10), (seconds % 10), dots);
+    disp_msg_t msg = {
+        .type = DISP_CMD_CHRONO_TICK, .sub = latched, .arg = cycles};
+    post_from_isr(&msg);
 }
 
-static void slot_machine_effect(void) {
-    for (int i = 0; i < 120; i++) {
-        update_tubes(esp_random() % 10, esp_random() % 10, esp_random() % 10,
-                     esp_random() % 10, esp_random() % 10, esp_random() % 10,
-                     false);
-        vTaskDelay(pdMS_TO_TICKS(50));
+static void chrono_show(uint32_t value) {
+    display_show(chrono_frame(value));
+    chrono_shown = value;
+}
+
+/* Shift in the frame for the coming tick. A countdown counts down. */
+static void chrono_preload_next(uint32_t value) {
+    chrono_next = (chrono_mode() == CHRONO_COUNTDOWN) ? value - 1 : value + 1;
+
+    uint32_t start = esp_cpu_get_cycle_count();
+    chrono_preloaded = display_preload(chrono_frame(chrono_next));
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+    chrono_shift_cycles += cycles;
+    if (cycles > chrono_shift_max) chrono_shift_max = cycles;
+}
+
+static void reset_chrono_stats(void) {
+    chrono_ticks = 0;
+    chrono_missed = 0;
+    chrono_latched = 0;
+    chrono_latch_cycles = 0;
+    chrono_shift_cycles = 0;
+    chrono_shift_max = 0;
+}
+
+static void report_chrono_stats(void) {
+    if (chrono_ticks < CHRONO_REPORT_TICKS) return;
+
+    ESP_LOGI(TAG,
+             "Chrono over %u ticks: %u latched on time, %u missed deadlines, "
+             "shift-out %u cycles avg (%u max), latch %u cycles avg",
+             (unsigned int)chrono_ticks, (unsigned int)chrono_latched,
+             (unsigned int)chrono_missed,
+             (unsigned int)(chrono_shift_cycles / chrono_ticks),
+             (unsigned int)chrono_shift_max,
+             (unsigned int)(chrono_latched
+                                ? chrono_latch_cycles / chrono_latched
+                                : 0));
+    reset_chrono_stats();
+}
+
+/* A preloaded frame that was not latched on its tick is a missed deadline:
+the display task did not get to preload in time. The tubes then catch up
+with the current value directly. */
+static void chrono_tick(bool latched, uint32_t latch_cycles) {
+    // A tick can still be queued after a stop
+    if (!chrono_running()) return;
+
+    uint32_t value = chrono_value(esp_timer_get_time());
+    chrono_ticks++;
+    if (latched) {
+        chrono_latched++;
+        chrono_latch_cycles += latch_cycles;
+        chrono_shown = chrono_next;
+        display_account();
+    } else if (chrono_preloaded) {
+        chrono_missed++;
+    }
+    chrono_preloaded = false;
+
+    if (value != chrono_shown) chrono_show(value);
+
+    if (chrono_mode() == CHRONO_COUNTDOWN && value == 0) {
+        esp_timer_stop(chrono_timer);
+        chrono_stop(esp_timer_get_time());
+        ESP_LOGI(TAG, "Countdown finished");
+        if (play_audio_task_handle) xTaskNotifyGive(play_audio_task_handle);
+        return;
+    }
+
+    chrono_preload_next(value);
+    report_chrono_stats();
+}
+
+static void handle_chrono_cmd(chrono_cmd_t cmd, uint32_t arg) {
+    int64_t now = esp_timer_get_time();
+
+    switch (cmd) {
+        case CHRONO_CMD_STOPWATCH:
+        case CHRONO_CMD_COUNTDOWN:
+            // The time display is suspended until CHRONO_CMD_EXIT
+            anim_cancel_all();
+            fade_active = false;
+            esp_timer_stop(frame_timer);
+            esp_timer_stop(edge_timer);
+            esp_timer_stop(chrono_timer);
+            chrono_set_mode(cmd == CHRONO_CMD_STOPWATCH ? CHRONO_STOPWATCH
+                                                        : CHRONO_COUNTDOWN,
+                            arg);
+            chrono_show(chrono_value(now));
+            break;
+
+        case CHRONO_CMD_START:
+            if (!chrono_start(now)) break;
+            reset_chrono_stats();
+            esp_timer_start_periodic(chrono_timer, CHRONO_TICK_MS * 1000);
+            chrono_preload_next(chrono_value(now));
+            break;
+
+        case CHRONO_CMD_STOP:
+            esp_timer_stop(chrono_timer);
+            chrono_stop(now);
+            chrono_show(chrono_value(now));
+            break;
+
+        case CHRONO_CMD_RESET:
+            esp_timer_stop(chrono_timer);
+            chrono_reset();
+            chrono_show(chrono_value(now));
+            break;
+
+        case CHRONO_CMD_EXIT:
+        default:
+            if (chrono_mode() != CHRONO_OFF) show_time();
+            break;
     }
 }
 
@@ -137,23 +502,72 @@ static void update_clock_task(void* pvParameters) {
 
     disp_msg_t msg;
 
+    update_shift_registers();
+    // Light the restored time now rather than on the first second edge
+    struct tm boot_tm;
+    wallclock_now(&boot_tm);
+    dimmer_update(&boot_tm);
+    schedule_second_edge();
+
     while (1) {
-        // Wait up to 1 second for command
-        if (xQueueReceive(disp_queue, &msg, pdMS_TO_TICKS(1000)) == pdTRUE) {
-            switch (msg.type) {
-                case DISP_CMD_SLOT_MACHINE:
-                    slot_machine_effect();
-                    break;
-
-                case DISP_CMD_SHOW_TIME:
-                default:
-                    update_shift_registers();
-                    break;
-            }
-
-        } else {
-            // Timeout every second → normal time update
+        // The edge timer posts every second; a long silence means it was lost
+        if (xQueueReceive(disp_queue, &msg, pdMS_TO_TICKS(2000)) != pdTRUE) {
+            // ...unless the stopwatch has the display
+            if (chrono_mode() != CHRONO_OFF) continue;
+            ESP_LOGW(TAG, "Second edge missed, rescheduling");
             update_shift_registers();
+            schedule_second_edge();
+            continue;
+        }
+
+        switch (msg.type) {
+            case DISP_CMD_FRAME:
+                frame_pending = false;
+                if (anim_active() || fade_active) render_frame();
+                break;
+
+            case DISP_CMD_SECOND_EDGE:
+                // An edge can still be queued after an effect took over
+                if (anim_active() || fade_active) break;
+                if (chrono_mode() != CHRONO_OFF) break;
+                if (!fade_enabled()) {
+                    // Already latched unless the frame had to be dithered
+                    display_show(time_frame(&edge_tm));
+                }
+                display_account();
+                dimmer_update(&edge_tm);
+                report_edge_stats();
+                cathode_save_if_due();
+                timekeep_tick();
+                if (cathode_slice_due()) {
+                    start_effect(&cathode_exercise_fx);
+                } else if (fade_enabled()) {
+                    start_fade(time_frame(&edge_tm));
+                } else {
+                    schedule_second_edge();
+                }
+                break;
+
+            case DISP_CMD_SLOT_MACHINE:
+                // The chime is not allowed to interrupt a timing
+                if (chrono_mode() == CHRONO_OFF) {
+                    start_slot_machine();
+                }
+                break;
+
+            case DISP_CMD_CHRONO:
+                handle_chrono_cmd((chrono_cmd_t)msg.sub, msg.arg);
+                break;
+
+            case DISP_CMD_CHRONO_TICK:
+                chrono_tick(msg.sub, msg.arg);
+                break;
+
+            case DISP_CMD_SHOW_TIME:
+            default:
+                // Explicit request for the time: drop any running effect
+                show_time();
+                break;
         }
     }
 }
@@ -169,10 +583,17 @@ void clock_send_slot_machine_with_leds(void) {
         ESP_LOGW(TAG, "Audio task handle not initialized");
     }
 
-    // Run the slot machine tubes animation
-    slot_machine_effect();
+    // Run the slot machine tubes animation on the display task
+    disp_msg_t msg = {.type = DISP_CMD_SLOT_MACHINE};
+    xQueueSend(disp_queue, &msg, 0);
+
+    ESP_LOGI(TAG, "Slot machine effect with LEDs and audio queued");
+}
 
-    ESP_LOGI(TAG, "Slot machine effect with LEDs and audio complete");
+/* Drive the stopwatch/countdown from other tasks (e.g. the web UI). */
+void clock_send_chrono(chrono_cmd_t cmd, uint32_t arg) {
+    disp_msg_t msg = {.type = DISP_CMD_CHRONO, .sub = cmd, .arg = arg};
+    xQueueSend(disp_queue, &msg, 0);
 }
 
 void clock_init(void) {
@@ -184,23 +605,53 @@ void clock_init(void) {
 
     gpio_config(&io_conf);
 
-    gpio_set_level(OE_PIN, 0);
+    // Outputs stay disabled until the dimmer lights them
+    gpio_set_level(OE_PIN, 1);
     gpio_set_level(CLOCK_PIN, 0);
     gpio_set_level(LATCH_PIN, 0);
 
-    // Load time format from config
-    char time_fmt_value[2] = {0};
-    read_config_value("time_fmt", time_fmt_value, sizeof(time_fmt_value));
-    if (time_fmt_value[0] != '\0') {
-        ram_time_fmt = atoi(time_fmt_value);
-    }
+    wallclock_init();
+
+    // Shift register transport (SPI or bit-bang, see Kconfig)
+    ESP_ERROR_CHECK(display_init());
+
+    // PWM brightness on ~OE
+    dimmer_init();
+
+    // Time format, colon and crossfade, now and whenever they change
+    settings_t settings;
+    settings_get(&settings);
+    apply_settings(&settings, SETTINGS_CLOCK);
+    settings_subscribe(SETTINGS_CLOCK, apply_settings);
 
     // Create display queue
-    disp_queue = xQueueCreate(5, sizeof(disp_msg_t));
+    disp_queue = QUEUE_CREATE(8, sizeof(disp_msg_t));
+
+    // Create second edge timer, dispatched from ISR when available to keep
+    // the latch close to the edge
+    esp_timer_create_args_t timer_args = {
+        .callback = &second_edge_cb,
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        .dispatch_method = ESP_TIMER_ISR,
+#endif
+        .name = "second_edge"};
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &edge_timer));
+
+    esp_timer_create_args_t frame_timer_args = {.callback = &frame_timer_cb,
+                                                .name = "anim_frame"};
+    ESP_ERROR_CHECK(esp_timer_create(&frame_timer_args, &frame_timer));
+
+    esp_timer_create_args_t chrono_timer_args = {
+        .callback = &chrono_tick_cb,
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        .dispatch_method = ESP_TIMER_ISR,
+#endif
+        .name = "chrono_tick"};
+    ESP_ERROR_CHECK(esp_timer_create(&chrono_timer_args, &chrono_timer));
 
     // Blank display at startup
-    update_tubes(10, 10, 10, 10, 10, 10, false);
+    display_show(0);
 
     // Create display task (ONLY hardware owner)
-    xTaskCreate(update_clock_task, "clk_task", 4096, NULL, 5, NULL);
+    TASK_CREATE(update_clock_task, "clk_task", 4096, NULL, 5, NULL);
 }
@@ -1,6 +1,7 @@
 #ifndef CLOCK_H
 #define CLOCK_H
 
+#include "chrono.h"
 #include "freertos/FreeRTOS.h"
 
 #define OE_PIN \
@@ -17,8 +18,11 @@
 // void slot_machine_effect(void);
 void clock_init(void);
 void clock_set_ram_format(int fmt);
+void clock_set_ram_colon(int mode);
+void clock_set_ram_fade(int ms);
 // void clock_send_slot_machine(void);
 void clock_send_slot_machine_with_leds(void);
+void clock_send_chrono(chrono_cmd_t cmd, uint32_t arg);
 
 #endif /* CLOCK_H */
 
@@ -1,14 +1,17 @@
 #include "config.h"
 
-#include <cJSON.h>
 #include <esp_log.h>
 #include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "static_alloc.h"
+#include "trace.h"
 #include "wifi_prov.h"
 
 /* In this file's comments, we use the term `configuration` to refer to the
@@ -16,220 +19,163 @@ actual JSON configuration file found at `CONFIG_FILENAME` and we use the term
 `config` to refer to the current WIFI configuration that is in flash.  Function
 names regardless, use `config` for brevity. */
 
+#define CONFIG_STREAM_BLOCK_SIZE 256
+
 static const char* TAG = "config";
 
-void write_default_config(void) {
-    FILE* f = fopen(CONFIG_FILENAME, "w");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file for writing");
-        return;
-    }
+#if CONFIG_STATIC_ALLOC
+/* Every read of the file goes through this one buffer, so whoever has it
+holds the lock until release_json_data. */
+static char file_buf[CONFIG_STATIC_CONFIG_BUF_SIZE];
+static SemaphoreHandle_t file_lock = NULL;
+#endif
 
-    fprintf(f, "{\n");
-    fprintf(f, "    \"ssid\": \"\",\n");
-    fprintf(f, "    \"pass\": \"\",\n");
-    fprintf(f, "    \"ntp\": \"pool.ntp.org\",\n");
-    fprintf(f, "    \"colon\": \"2\",\n");  // 2: Blinking, 1: On, 0: Off
-    fprintf(f, "    \"time\": {\n");
-    fprintf(f, "        \"city\": \"Los Angeles\",\n");
-    fprintf(f, "        \"timezone\": \"PST8PDT,M3.2.0,M11.1.0\",\n");
-    fprintf(f, "        \"time_fmt\": \"1\"\n");
-    fprintf(f, "    },\n");
-    fprintf(f, "    \"led_mode\": \"static\",\n");
-    fprintf(f, "    \"color\": {\n");
-    fprintf(f, "        \"r\": \"0\",\n");
-    fprintf(f, "        \"g\": \"0\",\n");
-    fprintf(f, "        \"b\": \"0\"\n");
-    fprintf(f, "    }\n");
-    fprintf(f, "}\n");
-
-    fclose(f);
-    ESP_LOGI(TAG, "Default configuration has been written to %s",
-             CONFIG_FILENAME);
-}
-
-char* read_json_data() {
-    FILE* f = fopen(CONFIG_FILENAME, "r");
-    if (f == NULL) {
-        return NULL;
-    }
+/* Read all of the opened config file into a buffer, and close it. */
+static char* read_file(FILE* f) {
+    // The buffer below is read into at once, so stdio needs none of its own
+    setvbuf(f, NULL, _IONBF, 0);
 
     fseek(f, 0, SEEK_END);
     long size = ftell(f);
     if (size == -1L) {
+        ESP_LOGI(TAG, "Failed to determine file size");
         fclose(f);
         return NULL;
     }
-
     fseek(f, 0, SEEK_SET);
+
+#if CONFIG_STATIC_ALLOC
+    if ((size_t)size >= sizeof(file_buf)) {
+        ESP_LOGE(TAG, "Config file of %ld bytes exceeds the %d byte buffer",
+                 size, CONFIG_STATIC_CONFIG_BUF_SIZE);
+        fclose(f);
+        return NULL;
+    }
+    xSemaphoreTake(file_lock, portMAX_DELAY);
+    char* data = file_buf;
+#else
     char* data = (char*)malloc(size + 1);
     if (data == NULL) {
+        ESP_LOGI(TAG, "Failed to allocate memory for buffer");
         fclose(f);
         return NULL;
     }
+#endif
 
+    TRACE_BEGIN("config read");
     size_t read_size = fread(data, 1, size, f);
+    fclose(f);
+    TRACE_END("config read");
     if (read_size != size) {
-        free(data);
-        fclose(f);
+        ESP_LOGI(TAG, "Failed to read the entire file");
+        release_json_data(data);
         return NULL;
     }
 
-    fclose(f);
     data[size] = '\0';
     return data;
 }
 
-bool find_value_in_json(cJSON* obj, const char* key, char* value,
-                        size_t value_size) {
-    if (obj == NULL || key == NULL || value == NULL || value_size == 0) {
-        return false;
-    }
-
-    if (cJSON_IsObject(obj)) {
-        cJSON* child = obj->child;
-        while (child != NULL) {
-            if (strcmp(child->string, key) == 0 && cJSON_IsString(child)) {
-                strncpy(value, child->valuestring, value_size);
-                value[value_size - 1] = '\0';
-                return true;
-            } else if (cJSON_IsObject(child)) {
-                if (find_value_in_json(child, key, value, value_size)) {
-                    return true;
-                }
-            }
-            child = child->next;
-        }
+/* The file's contents, to be handed back with release_json_data. */
+char* read_json_data() {
+    FILE* f = fopen(CONFIG_FILENAME, "r");
+    if (f == NULL) {
+        return NULL;
     }
-
-    return false;
+    return read_file(f);
 }
 
-void read_config_value(const char* key, char* value, size_t value_size) {
-    FILE* file = fopen(CONFIG_FILENAME, "r");
-    if (file == NULL) {
-        ESP_LOGI(TAG, "Failed to open config file");
-        return;
-    }
+void release_json_data(char* data) {
+    if (data == NULL) return;
+#if CONFIG_STATIC_ALLOC
+    xSemaphoreGive(file_lock);
+#else
+    free(data);
+#endif
+}
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    if (file_size == -1L) {
-        ESP_LOGI(TAG, "Failed to determine file size");
-        fclose(file);
-        return;
+/* Feed the file to `js` a block at a time, so that it is never held in RAM
+whole. ESP_ERR_NOT_FOUND if there is no file. */
+esp_err_t read_json_stream(json_stream_t* js) {
+    FILE* f = fopen(CONFIG_FILENAME, "r");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
+    // Read a block at a time below, so stdio needs no buffer of its own
+    setvbuf(f, NULL, _IONBF, 0);
 
-    fseek(file, 0, SEEK_SET);
-    char* buffer = (char*)malloc(file_size + 1);
-    if (buffer == NULL) {
-        ESP_LOGI(TAG, "Failed to allocate memory for buffer");
-        fclose(file);
-        return;
+    char buf[CONFIG_STREAM_BLOCK_SIZE];
+    esp_err_t ret = ESP_OK;
+    size_t n;
+    TRACE_BEGIN("config read");
+    while (ret == ESP_OK && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        ret = json_stream_feed(js, buf, n);
     }
-
-    size_t read_size = fread(buffer, 1, file_size, file);
-    fclose(file);
-    if (read_size != file_size) {
+    if (ret == ESP_OK && ferror(f)) {
         ESP_LOGI(TAG, "Failed to read the entire file");
-        free(buffer);
-        return;
+        ret = ESP_FAIL;
     }
+    fclose(f);
+    TRACE_END("config read");
+    return ret == ESP_OK ? json_stream_finish(js) : ret;
+}
 
-    buffer[file_size] = '\0';
-    cJSON* root = cJSON_Parse(buffer);
-    free(buffer);
-    if (root == NULL) {
-        ESP_LOGI(TAG, "Failed to parse JSON");
-        return;
-    }
+/* Clean up after a write_json_data that failed or power loss cut short. A
+temporary file next to the config is unfinished or superseded; one on its
+own is complete, since the config is only removed after it was written. */
+static void recover(void) {
+    struct stat st;
+    if (stat(CONFIG_TMP_FILENAME, &st) != 0) return;
 
-    if (!find_value_in_json(root, key, value, value_size)) {
-        ESP_LOGI(TAG, "%s not found in JSON or is not a string", key);
+    if (stat(CONFIG_FILENAME, &st) == 0) {
+        unlink(CONFIG_TMP_FILENAME);
+        ESP_LOGW(TAG, "Dropped an unfinished config save");
+    } else if (rename(CONFIG_TMP_FILENAME, CONFIG_FILENAME) == 0) {
+        ESP_LOGW(TAG, "Completed an interrupted config save");
     }
-
-    cJSON_Delete(root);
 }
 
-void write_config_value(const char* key, const char* value) {
-    FILE* file = fopen(CONFIG_FILENAME, "r");
-    cJSON* root = NULL;
-
-    if (file) {
-        fseek(file, 0, SEEK_END);
-        long length = ftell(file);
-        if (length == -1L) {
-            ESP_LOGI(TAG, "Failed to determine file size");
-            fclose(file);
-            return;
-        }
-
-        fseek(file, 0, SEEK_SET);
-        char* data = (char*)malloc(length + 1);
-        if (data == NULL) {
-            ESP_LOGI(TAG, "Failed to allocate memory for data");
-            fclose(file);
-            return;
-        }
-
-        size_t read_size = fread(data, 1, length, file);
-        fclose(file);
-        if (read_size != length) {
-            ESP_LOGI(TAG, "Failed to read the entire file");
-            free(data);
-            return;
-        }
-
-        data[length] = '\0';
-        root = cJSON_Parse(data);
-        free(data);
-        if (root == NULL) {
-            ESP_LOGI(TAG, "Failed to parse JSON");
-            return;
-        }
-    } else {
-        root = cJSON_CreateObject();
+/* Replace the file's contents with `text`, so that a power loss leaves
+either the old or the new contents. The text goes to a temporary file
+first, which then takes the file's place; SPIFFS cannot rename over an
+existing file, so there the old one is removed first and config_init
+finishes the job if power is lost in between. */
+esp_err_t write_json_data(const char* text) {
+    FILE* f = fopen(CONFIG_TMP_FILENAME, "w");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open config file for writing");
+        return ESP_FAIL;
     }
 
-    cJSON* value_json = cJSON_CreateString(value);
-    if (value_json == NULL) {
-        cJSON_Delete(root);
-        ESP_LOGI(TAG, "Failed to create JSON string");
-        return;
+    TRACE_BEGIN("config write");
+    bool ok = fputs(text, f) >= 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(CONFIG_TMP_FILENAME, CONFIG_FILENAME) != 0) {
+        ok = unlink(CONFIG_FILENAME) == 0 &&
+             rename(CONFIG_TMP_FILENAME, CONFIG_FILENAME) == 0;
     }
-
-    cJSON_ReplaceItemInObject(root, key, value_json);
-
-    char* json_str = cJSON_Print(root);
-    cJSON_Delete(root);
-    if (json_str == NULL) {
-        ESP_LOGI(TAG, "Failed to generate JSON string");
-        return;
+    TRACE_END("config write");
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write config file");
+        recover();
+        return ESP_FAIL;
     }
+    ESP_LOGI(TAG, "Config file updated successfully");
+    return ESP_OK;
+}
 
-    file = fopen(CONFIG_FILENAME, "w");
-    if (file == NULL) {
-        ESP_LOGI(TAG, "Failed to open config file for writing");
-        free(json_str);
-        return;
+/* Keep the file as CONFIG_OLD_FILENAME, out of the way of later firmware
+and for whoever wants the old settings back. */
+void archive_json_data(void) {
+    unlink(CONFIG_OLD_FILENAME);
+    if (rename(CONFIG_FILENAME, CONFIG_OLD_FILENAME) != 0) {
+        ESP_LOGW(TAG, "Failed to rename %s", CONFIG_FILENAME);
     }
-
-    fputs(json_str, file);
-    fclose(file);
-    free(json_str);
-    ESP_LOGI(TAG, "Config file updated successfully");
 }
 
 void config_init(void) {
-    // // Get current WiFi config
-    // wifi_config_t current_config;
-    // esp_wifi_get_config(ESP_IF_WIFI_STA, &current_config);
-
-    /* Create default config file if it doesn't exist */
-    struct stat st;
-    if (stat(CONFIG_FILENAME, &st) != 0) {
-        write_default_config();
-    } else {
-        ESP_LOGI(TAG, "Default configuration file already exists!");
-    }
+#if CONFIG_STATIC_ALLOC
+    file_lock = MUTEX_CREATE();
+#endif
+    recover();
 }
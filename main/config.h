@@ -3,13 +3,18 @@
 
 #include <esp_wifi.h>
 
+#include "json_stream.h"
+
 #define CONFIG_FILENAME "/spiffs/config.json"
+#define CONFIG_TMP_FILENAME "/spiffs/config.json.tmp"
+#define CONFIG_OLD_FILENAME "/spiffs/config.json.old"
 
 void config_init(void);
-void write_default_config();
 char* read_json_data();
-void read_config_value(const char* key, char* value, size_t value_size);
-void write_config_value(const char* key, const char* value);
+void release_json_data(char* data);
+esp_err_t read_json_stream(json_stream_t* js);
+esp_err_t write_json_data(const char* text);
+void archive_json_data(void);
 void check_and_update_wifi_config(wifi_config_t* current_config);
 void update_config_wifi(const char* ssid, const char* password,
                         const char* prev_ssid, const char* prev_password);
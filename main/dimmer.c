@@ -0,0 +1,130 @@
+#include "dimmer.h"
+
+#include <driver/ledc.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+
+#include "clock.h"
+#include "settings.h"
+#include "timekeep.h"
+
+#define DIMMER_MODE LEDC_LOW_SPEED_MODE
+#define DIMMER_TIMER LEDC_TIMER_0
+#define DIMMER_CHANNEL LEDC_CHANNEL_0
+#define DIMMER_RESOLUTION LEDC_TIMER_13_BIT
+
+static const char* TAG = "dimmer";
+
+/* Perceptual brightness (percent) to 13-bit duty, gamma 2.2. */
+static const uint16_t gamma_duty[101] = {
+    0,    0,    1,    4,    7,    11,   17,   24,   32,   41,   52,   64,
+    77,   92,   108,  126,  145,  166,  188,  212,  237,  264,  293,  323,
+    355,  388,  423,  460,  498,  538,  579,  623,  668,  715,  763,  813,
+    865,  919,  975,  1032, 1091, 1152, 1215, 1279, 1346, 1414, 1484, 1556,
+    1630, 1705, 1783, 1862, 1943, 2026, 2112, 2199, 2287, 2378, 2471, 2566,
+    2662, 2761, 2862, 2964, 3069, 3175, 3283, 3394, 3506, 3621, 3737, 3856,
+    3976, 4099, 4223, 4350, 4478, 4609, 4742, 4877, 5013, 5152, 5293, 5436,
+    5582, 5729, 5878, 6029, 6183, 6339, 6496, 6656, 6818, 6982, 7149, 7317,
+    7487, 7660, 7835, 8012, 8191};
+
+// Written by the web server's task, read by the display task
+static dimmer_schedule_t schedule = {
+    .day = 100, .night = 100, .night_from = 22, .night_to = 6};
+static portMUX_TYPE schedule_mux = portMUX_INITIALIZER_UNLOCKED;
+static int current_level = -1;
+static bool lit = false;  // ~OE has been enabled
+
+static bool in_night_window(const dimmer_schedule_t* s, int hour) {
+    if (s->night_from == s->night_to) return false;
+    if (s->night_from < s->night_to) {
+        return hour >= s->night_from && hour < s->night_to;
+    }
+    return hour >= s->night_from || hour < s->night_to;
+}
+
+/* Fade ~OE to the given brightness. The LEDC fade runs in hardware, so this
+costs one call however long the transition is. A fade still running is
+stopped where it is first: starting over it would block on the driver's
+fade semaphore until it ends, stalling the display task. */
+static void fade_to(int level) {
+    if (level == current_level) return;
+    current_level = level;
+    ledc_fade_stop(DIMMER_MODE, DIMMER_CHANNEL);
+    ledc_set_fade_time_and_start(DIMMER_MODE, DIMMER_CHANNEL,
+                                 gamma_duty[level], CONFIG_DIMMER_FADE_MS,
+                                 LEDC_FADE_NO_WAIT);
+    ESP_LOGI(TAG, "Brightness -> %d%%", level);
+}
+
+/* Enable ~OE at `level` at once, for the first light after boot. */
+static void light(int level) {
+    current_level = level;
+    lit = true;
+    ledc_set_duty(DIMMER_MODE, DIMMER_CHANNEL, gamma_duty[level]);
+    ledc_update_duty(DIMMER_MODE, DIMMER_CHANNEL);
+    ESP_LOGI(TAG, "Tubes lit at %d%%, %lld ms after boot", level,
+             esp_timer_get_time() / 1000);
+}
+
+static void apply_settings(const settings_t* s, uint32_t changed) {
+    dimmer_set_schedule(&s->dimmer);
+}
+
+void dimmer_init(void) {
+    ledc_timer_config_t timer_cfg = {.speed_mode = DIMMER_MODE,
+                                     .duty_resolution = DIMMER_RESOLUTION,
+                                     .timer_num = DIMMER_TIMER,
+                                     .freq_hz = CONFIG_DIMMER_PWM_FREQ_HZ,
+                                     .clk_cfg = LEDC_AUTO_CLK};
+    ESP_ERROR_CHECK(ledc_timer_config(&timer_cfg));
+
+    // ~OE is active low: invert so that duty is the fraction of time lit
+    ledc_channel_config_t channel_cfg = {.gpio_num = OE_PIN,
+                                         .speed_mode = DIMMER_MODE,
+                                         .channel = DIMMER_CHANNEL,
+                                         .intr_type = LEDC_INTR_DISABLE,
+                                         .timer_sel = DIMMER_TIMER,
+                                         .duty = 0,
+                                         .hpoint = 0,
+                                         .flags.output_invert = 1};
+    ESP_ERROR_CHECK(ledc_channel_config(&channel_cfg));
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+
+    settings_t settings;
+    settings_get(&settings);
+    dimmer_set_schedule(&settings.dimmer);
+    settings_subscribe(SETTINGS_DIMMER, apply_settings);
+}
+
+void dimmer_set_schedule(const dimmer_schedule_t* new_schedule) {
+    dimmer_schedule_t s = *new_schedule;
+    if (s.day > 100) s.day = 100;
+    if (s.night > 100) s.night = 100;
+
+    portENTER_CRITICAL(&schedule_mux);
+    schedule = s;
+    portEXIT_CRITICAL(&schedule_mux);
+
+    ESP_LOGI(TAG, "Schedule updated: %d%% day, %d%% night %02d:00-%02d:00",
+             s.day, s.night, s.night_from, s.night_to);
+}
+
+/* Pick the scheduled level for the given local time; only starts a fade
+when the level actually changes. The tubes stay dark until the time is
+restored or synced, and then light at the level without fading in. */
+void dimmer_update(const struct tm* timeinfo) {
+    if (!timekeep_valid()) return;
+
+    portENTER_CRITICAL(&schedule_mux);
+    dimmer_schedule_t s = schedule;
+    portEXIT_CRITICAL(&schedule_mux);
+
+    int level = in_night_window(&s, timeinfo->tm_hour) ? s.night : s.day;
+    if (lit) {
+        fade_to(level);
+    } else {
+        light(level);
+    }
+}
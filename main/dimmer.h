@@ -0,0 +1,19 @@
+#ifndef DIMMER_H
+#define DIMMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Brightness levels are perceptual percentages (0-100)
+typedef struct {
+    uint8_t day;         // Brightness outside the night window
+    uint8_t night;       // Brightness inside the night window
+    uint8_t night_from;  // Hour the night window starts (0-23)
+    uint8_t night_to;    // Hour it ends; equal to night_from disables it
+} dimmer_schedule_t;
+
+void dimmer_init(void);
+void dimmer_set_schedule(const dimmer_schedule_t* schedule);
+void dimmer_update(const struct tm* timeinfo);
+
+#endif /* DIMMER_H */
@@ -0,0 +1,137 @@
+#include "discipline.h"
+
+#include <stdlib.h>
+
+// Largest frequency error corrected, as in NTP
+#define DISC_MAX_FREQ_PPB 500000
+// Offsets over the step threshold in this many consecutive polls are a real
+// step; fewer are treated as a bad network path
+#define DISC_SPIKE_LIMIT 2
+// A frequency sample needs this much time since the last update to mean
+// anything against the network jitter
+#define DISC_MIN_FREQ_SPAN_US (16 * 1000000LL)
+// Each frequency sample moves the estimate by 1/DISC_FREQ_GAIN of itself
+#define DISC_FREQ_GAIN 4
+// Poll interval adaptation, after RFC 5905: offsets within DISC_PGATE times
+// the jitter vote for a longer interval, others for a shorter one
+#define DISC_PGATE 4
+#define DISC_JIGGLE_LIMIT 30
+// Jitter below this is not resolved by the network, however quiet it is
+#define DISC_JITTER_FLOOR_US 500
+
+static int64_t isqrt64(int64_t v) {
+    if (v <= 0) return 0;
+    int64_t r = 0;
+    int64_t bit = (int64_t)1 << 62;
+    while (bit > v) bit >>= 2;
+    while (bit != 0) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+void discipline_init(discipline_t* d, int32_t freq_ppb, int min_poll,
+                     int max_poll, int64_t step_us) {
+    // A longest interval below the shortest would pin the poll there
+    if (max_poll < min_poll) max_poll = min_poll;
+    *d = (discipline_t){.step_us = step_us,
+                        .min_poll = min_poll,
+                        .max_poll = max_poll,
+                        .poll = min_poll,
+                        .jitter_us = DISC_JITTER_FLOOR_US,
+                        .freq_ppb = freq_ppb};
+}
+
+/* Clock filter: of one burst, the sample with the shortest round trip has
+the least room for asymmetric queueing delay, so its offset is the most
+trustworthy. Returns its index, or -1 for an empty burst. */
+int discipline_select(const disc_sample_t* samples, int n) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        if (best < 0 || samples[i].delay_us < samples[best].delay_us) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void adapt_poll(discipline_t* d, int64_t offset_us) {
+    int64_t gate = d->jitter_us < DISC_JITTER_FLOOR_US ? DISC_JITTER_FLOOR_US
+                                                        : d->jitter_us;
+    if (llabs(offset_us) < DISC_PGATE * gate) {
+        d->jiggle += d->poll;
+        if (d->jiggle > DISC_JIGGLE_LIMIT) {
+            d->jiggle = 0;
+            if (d->poll < d->max_poll) d->poll++;
+        }
+    } else {
+        d->jiggle -= 2 * d->poll;
+        if (d->jiggle < -DISC_JIGGLE_LIMIT) {
+            d->jiggle = 0;
+            if (d->poll > d->min_poll) d->poll--;
+        }
+    }
+}
+
+/* Feed one poll burst. Returns what to do with d->offset_us. */
+disc_action_t discipline_update(discipline_t* d, const disc_sample_t* samples,
+                                int n, int64_t mono_us) {
+    int best = discipline_select(samples, n);
+    if (best < 0) return DISC_IGNORE;
+    int64_t offset = samples[best].offset_us;
+    bool over = llabs(offset) > d->step_us;
+
+    if (!d->synced) {
+        // Whatever time we booted with was only an estimate
+        d->synced = true;
+    } else if (over) {
+        if (++d->spikes < DISC_SPIKE_LIMIT) return DISC_IGNORE;
+    } else {
+        /* The previous offset was slewed away, so what built up since is the
+        residual frequency error. */
+        int64_t span = mono_us - d->last_update_us;
+        if (span >= DISC_MIN_FREQ_SPAN_US) {
+            int64_t sample = offset * 1000000000LL / span;
+            int64_t freq = d->freq_ppb + sample / DISC_FREQ_GAIN;
+            if (freq > DISC_MAX_FREQ_PPB) freq = DISC_MAX_FREQ_PPB;
+            if (freq < -DISC_MAX_FREQ_PPB) freq = -DISC_MAX_FREQ_PPB;
+            d->freq_ppb = (int32_t)freq;
+        }
+
+        // Exponential RMS of the offset differences, as in RFC 5905. A step
+        // took the previous offset out in full.
+        int64_t diff = offset - (d->stepped ? 0 : d->offset_us);
+        int64_t var = d->jitter_us * d->jitter_us;
+        d->jitter_us = isqrt64(var + (diff * diff - var) / 4);
+        adapt_poll(d, offset);
+    }
+
+    d->spikes = 0;
+    d->offset_us = offset;
+    d->delay_us = samples[best].delay_us;
+    d->last_update_us = mono_us;
+    d->stepped = over;
+
+    if (over) {
+        // Whatever was learnt about the network no longer applies
+        d->poll = d->min_poll;
+        d->jiggle = 0;
+        return DISC_STEP;
+    }
+    return DISC_SLEW;
+}
+
+/* Whole microseconds the clock must be advanced by to make up for the
+frequency error over `elapsed_us`; the remainder is carried over. */
+int64_t discipline_freq_correction(discipline_t* d, int64_t elapsed_us) {
+    int64_t total = (int64_t)d->freq_ppb * elapsed_us + d->freq_residue;
+    int64_t us = total / 1000000000LL;
+    d->freq_residue = total - us * 1000000000LL;
+    return us;
+}
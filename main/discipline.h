@@ -0,0 +1,50 @@
+#ifndef DISCIPLINE_H
+#define DISCIPLINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most samples taken in one poll burst
+#define DISC_MAX_SAMPLES 8
+
+typedef struct {
+    int64_t offset_us;  // Server time minus local time
+    int64_t delay_us;   // Round trip, less the server's processing time
+} disc_sample_t;
+
+typedef enum {
+    DISC_IGNORE,  // Outlier, leave the clock alone
+    DISC_STEP,    // Set the clock to local time + offset
+    DISC_SLEW     // adjtime() by the offset
+} disc_action_t;
+
+/* Clock discipline state. Pure arithmetic with no platform dependencies, so
+it also builds on a host against simulated samples. Times are in
+microseconds; `mono_us` arguments come from a clock that is never adjusted.
+Frequency is in parts per billion, positive when the local clock runs
+slow. */
+typedef struct {
+    bool synced;
+    bool stepped;  // The last update stepped the clock
+    int spikes;    // Consecutive polls over the step threshold
+    int64_t step_us;
+    int min_poll;  // log2 seconds
+    int max_poll;
+    int poll;
+    int jiggle;  // Votes for a longer (+) or shorter (-) poll interval
+    int64_t offset_us;
+    int64_t delay_us;
+    int64_t jitter_us;
+    int32_t freq_ppb;
+    int64_t freq_residue;  // Sub-microsecond remainder, in 1e-9 us
+    int64_t last_update_us;
+} discipline_t;
+
+void discipline_init(discipline_t* d, int32_t freq_ppb, int min_poll,
+                     int max_poll, int64_t step_us);
+int discipline_select(const disc_sample_t* samples, int n);
+disc_action_t discipline_update(discipline_t* d, const disc_sample_t* samples,
+                                int n, int64_t mono_us);
+int64_t discipline_freq_correction(discipline_t* d, int64_t elapsed_us);
+
+#endif /* DISCIPLINE_H */
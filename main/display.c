@@ -0,0 +1,187 @@
+#include "display.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "cathode.h"
+#include "dither.h"
+#include "settings.h"
+#include "tube_bus.h"
+
+static const char* TAG = "display";
+
+/* Tube wiring: the shift register output (in shift order) that drives each
+cathode 0-9 of each tube, left to right. This is the only place the PCB
+routing is described; a board revision only needs a new set of rows. */
+#define WIRING_HH 7, 6, 5, 4, 3, 2, 1, 0, 15, 14
+#define WIRING_H 13, 12, 11, 10, 9, 8, 23, 22, 21, 20
+#define WIRING_MM 17, 16, 31, 30, 29, 28, 27, 26, 25, 24
+#define WIRING_M 39, 38, 37, 36, 35, 34, 33, 32, 47, 46
+#define WIRING_SS 43, 42, 41, 40, 55, 54, 53, 52, 51, 50
+#define WIRING_S 49, 48, 63, 62, 61, 60, 59, 58, 57, 56
+
+#define TUBE_ROW(...) TUBE_ROW_(__VA_ARGS__)
+#define TUBE_ROW_(d0, d1, d2, d3, d4, d5, d6, d7, d8, d9)                 \
+    {TUBE_BIT(d0), TUBE_BIT(d1), TUBE_BIT(d2), TUBE_BIT(d3), TUBE_BIT(d4), \
+     TUBE_BIT(d5), TUBE_BIT(d6), TUBE_BIT(d7), TUBE_BIT(d8), TUBE_BIT(d9), \
+     0}
+
+#define TUBE_COVER(...) TUBE_COVER_(__VA_ARGS__)
+#define TUBE_COVER_(d0, d1, d2, d3, d4, d5, d6, d7, d8, d9)              \
+    (TUBE_BIT(d0) | TUBE_BIT(d1) | TUBE_BIT(d2) | TUBE_BIT(d3) |          \
+     TUBE_BIT(d4) | TUBE_BIT(d5) | TUBE_BIT(d6) | TUBE_BIT(d7) |          \
+     TUBE_BIT(d8) | TUBE_BIT(d9))
+
+const uint64_t display_digit_mask[DISPLAY_TUBES][DISPLAY_BLANK + 1] = {
+    TUBE_ROW(WIRING_HH), TUBE_ROW(WIRING_H),  TUBE_ROW(WIRING_MM),
+    TUBE_ROW(WIRING_M),  TUBE_ROW(WIRING_SS), TUBE_ROW(WIRING_S),
+};
+
+const uint64_t display_tube_cover[DISPLAY_TUBES] = {
+    TUBE_COVER(WIRING_HH), TUBE_COVER(WIRING_H),  TUBE_COVER(WIRING_MM),
+    TUBE_COVER(WIRING_M),  TUBE_COVER(WIRING_SS), TUBE_COVER(WIRING_S),
+};
+
+static uint64_t last_frame = 0;
+static bool last_frame_valid = false;
+static uint64_t preload_frame = 0;
+static volatile bool preload_armed = false;
+
+// Frame whose on-time has not been credited to its cathodes yet
+static uint64_t accounted_frame = 0;
+static int64_t accounted_since_us = 0;
+
+static void apply_settings(const settings_t* s, uint32_t changed) {
+    display_set_tube_levels(s->tube_bri);
+}
+
+esp_err_t display_init(void) {
+    last_frame_valid = false;
+    preload_armed = false;
+    accounted_since_us = esp_timer_get_time();
+    cathode_init();
+
+    esp_err_t ret = tube_bus_init();
+#if CONFIG_DITHER
+    if (ret == ESP_OK) ret = dither_init();
+
+    settings_t settings;
+    settings_get(&settings);
+    dither_set_levels(settings.tube_bri);
+#endif
+    settings_subscribe(SETTINGS_TUBES, apply_settings);
+    return ret;
+}
+
+/* Build a frame from six digits (DISPLAY_BLANK or out of range blanks the
+tube) plus any extra bits such as the colons. */
+uint64_t display_compose(const uint8_t digits[DISPLAY_TUBES], uint64_t extra) {
+    uint64_t frame = extra;
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        uint8_t d = digits[t] <= DISPLAY_BLANK ? digits[t] : DISPLAY_BLANK;
+        frame |= display_digit_mask[t][d];
+    }
+    return frame;
+}
+
+/* Shift and latch a frame, skipping the transfer entirely when it matches
+the frame currently held in the output registers. */
+static void show_steady(uint64_t frame) {
+    preload_armed = false;
+    if (last_frame_valid && frame == last_frame) {
+        return;
+    }
+    tube_bus_write(frame);
+    last_frame = frame;
+    last_frame_valid = true;
+    display_account();
+}
+
+void display_show(uint64_t frame) {
+    display_fade(frame, frame, 0);
+}
+
+/* Show `to` for weight/DITHER_SLOTS of the time and `from` for the rest.
+With dithering disabled this degrades to a hard switch half way. The frame
+with the larger share is the one accounted to the cathodes. */
+void display_fade(uint64_t from, uint64_t to, uint8_t weight) {
+#if CONFIG_DITHER
+    uint64_t steady;
+    if (!dither_show(from, to, weight, &steady)) {
+        show_steady(steady);
+        return;
+    }
+
+    // The registers now change every slot: never skip the next steady frame
+    preload_armed = false;
+    last_frame_valid = false;
+    uint64_t nominal = (weight * 2 >= DITHER_SLOTS) ? to : from;
+    if (nominal != last_frame) {
+        last_frame = nominal;
+        display_account();
+    }
+#else
+    show_steady((weight * 2 >= DITHER_SLOTS) ? to : from);
+#endif
+}
+
+/* Load a frame into the shift stage without touching the outputs. It becomes
+visible on the next display_latch(), so the expensive part of a frame change
+can be done well ahead of the moment it has to appear. Returns false when the
+frame cannot be preloaded because it has to be dithered; the caller then
+shows it with display_show() instead. */
+bool display_preload(uint64_t frame) {
+#if CONFIG_DITHER
+    uint64_t steady;
+    if (dither_running() || !dither_steady(frame, &steady)) return false;
+    frame = steady;
+#endif
+    preload_frame = frame;
+    tube_bus_shift(frame);
+    preload_armed = true;
+    return true;
+}
+
+/* Make the preloaded frame visible. Only a LATCH_PIN pulse; ISR safe.
+Returns false, doing nothing, unless a preload is pending. */
+bool IRAM_ATTR display_latch(void) {
+    if (!preload_armed) return false;
+    preload_armed = false;
+    tube_bus_latch();
+    last_frame = preload_frame;
+    last_frame_valid = true;
+    return true;
+}
+
+/* Last frame made visible (the dominant one while dithering). */
+uint64_t display_current(void) {
+    return last_frame;
+}
+
+/* Set each tube's brightness in percent on top of the ~OE level. Needs the
+dithering engine; without it all tubes stay at full level. */
+void display_set_tube_levels(const uint8_t percent[DISPLAY_TUBES]) {
+#if CONFIG_DITHER
+    dither_set_levels(percent);
+#else
+    ESP_LOGW(TAG, "Per-tube brightness needs CONFIG_DITHER");
+#endif
+}
+
+/* Credit the time the previous frame was visible to its cathodes. The
+display task calls this after every visible change, including after a
+display_latch() from the edge timer. Only whole milliseconds are credited;
+the rest carries over to the next call. */
+void display_account(void) {
+    int64_t elapsed_ms = (esp_timer_get_time() - accounted_since_us) / 1000;
+    cathode_account(accounted_frame, (uint32_t)elapsed_ms);
+    accounted_frame = last_frame;
+    accounted_since_us += elapsed_ms * 1000;
+}
+
+/* Force the next display_show() to go out, e.g. after the registers may
+have been disturbed. */
+void display_invalidate(void) {
+    last_frame_valid = false;
+}
@@ -0,0 +1,38 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DISPLAY_TUBES 6
+#define DISPLAY_BLANK 10  // Digit value that lights no cathode
+
+// Frame bit for a shift register output, counted in shift order (the first
+// bit shifted out lands on output 63 of the chain)
+#define TUBE_BIT(pos) (1ULL << (63 - (pos)))
+
+// Colon neon lamps, left (H:MM) and right (M:SS)
+#define DISPLAY_COLON_LEFT (TUBE_BIT(18) | TUBE_BIT(19))
+#define DISPLAY_COLON_RIGHT (TUBE_BIT(44) | TUBE_BIT(45))
+#define DISPLAY_COLONS (DISPLAY_COLON_LEFT | DISPLAY_COLON_RIGHT)
+#define DISPLAY_ALL UINT64_MAX
+
+// digit_mask[tube][digit]: tube 0 is the leftmost (tens of hours), digit 10
+// is blank
+extern const uint64_t display_digit_mask[DISPLAY_TUBES][DISPLAY_BLANK + 1];
+// All cathodes of a tube, e.g. to let one layer own that tube
+extern const uint64_t display_tube_cover[DISPLAY_TUBES];
+
+esp_err_t display_init(void);
+uint64_t display_compose(const uint8_t digits[DISPLAY_TUBES], uint64_t extra);
+void display_show(uint64_t frame);
+void display_fade(uint64_t from, uint64_t to, uint8_t weight);
+bool display_preload(uint64_t frame);
+bool display_latch(void);
+uint64_t display_current(void);
+void display_set_tube_levels(const uint8_t percent[DISPLAY_TUBES]);
+void display_account(void);
+void display_invalidate(void);
+
+#endif /* DISPLAY_H */
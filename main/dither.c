@@ -0,0 +1,262 @@
+#include "dither.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+
+#include "static_alloc.h"
+#include "tube_bus.h"
+
+#define DITHER_TASK_PRIORITY 20  // Above the display task, below Wi-Fi
+#define DITHER_REPORT_US (10 * 1000000LL)
+
+static const char* TAG = "dither";
+
+/* Bit-reversed slot order. A tube lit for n slots of a cycle takes the slots
+whose rank is below n, which spreads them evenly over the cycle instead of
+bunching them into one long pulse at the cycle rate. */
+static const uint8_t slot_rank[DITHER_SLOTS] = {0, 8,  4, 12, 2, 10, 6, 14,
+                                                1, 9,  5, 13, 3, 11, 7, 15};
+
+/* A plan is one precomputed dither cycle. The display task builds it; the
+dither task only walks it and pushes the sub-frames that differ from the one
+before. Plans are double-buffered so publishing one is a single store. */
+static uint64_t plans[2][DITHER_SLOTS];
+static volatile int active_plan = -1;  // -1: not dithering
+
+// Slots per cycle each tube is lit for
+static portMUX_TYPE levels_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t tube_slots[DISPLAY_TUBES] = {
+    DITHER_SLOTS, DITHER_SLOTS, DITHER_SLOTS,
+    DITHER_SLOTS, DITHER_SLOTS, DITHER_SLOTS};
+static bool levels_full = true;
+
+static esp_timer_handle_t slot_timer = NULL;
+static TaskHandle_t dither_task_handle = NULL;
+// Held by the dither task while it pushes a sub-frame
+static SemaphoreHandle_t bus_lock = NULL;
+
+/* Lay out one cycle mixing `from` and `to`, `to` taking weight/DITHER_SLOTS
+of each tube's lit time. Tube t's slots are rotated by t so dimmed tubes do
+not all light together. The colons are never dimmed but do crossfade. */
+static void build_plan(uint64_t plan[DITHER_SLOTS], uint64_t from, uint64_t to,
+                       uint8_t weight) {
+    uint8_t lit[DISPLAY_TUBES];
+    uint8_t lit_to[DISPLAY_TUBES];
+
+    portENTER_CRITICAL(&levels_mux);
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        lit[t] = tube_slots[t];
+    }
+    portEXIT_CRITICAL(&levels_mux);
+
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        lit_to[t] = (lit[t] * weight + DITHER_SLOTS / 2) / DITHER_SLOTS;
+    }
+
+    for (int s = 0; s < DITHER_SLOTS; s++) {
+        uint64_t frame = (slot_rank[s] < weight ? to : from) & DISPLAY_COLONS;
+        for (int t = 0; t < DISPLAY_TUBES; t++) {
+            uint8_t rank = slot_rank[(s + t) % DITHER_SLOTS];
+            if (rank < lit_to[t]) {
+                frame |= to & display_tube_cover[t];
+            } else if (rank < lit[t]) {
+                frame |= from & display_tube_cover[t];
+            }
+        }
+        plan[s] = frame;
+    }
+}
+
+static void IRAM_ATTR slot_timer_cb(void* arg) {
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(dither_task_handle, &woken);
+    if (woken) esp_timer_isr_dispatch_need_yield();
+#else
+    xTaskNotifyGive(dither_task_handle);
+#endif
+}
+
+/* Push one sub-frame per slot tick, and once per report window log the CPU
+time spent doing so against CONFIG_DITHER_CPU_BUDGET_PCT. The figure covers
+this task only; the timer interrupt adds a few microseconds per tick. */
+static void dither_task(void* arg) {
+    uint8_t slot = 0;
+    uint64_t shown = 0;
+    bool shown_valid = false;
+
+    int64_t window_start = esp_timer_get_time();
+    int64_t busy_us = 0;
+    uint32_t ticks = 0;
+    uint32_t writes = 0;
+    uint32_t overruns = 0;
+
+    while (1) {
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        xSemaphoreTake(bus_lock, portMAX_DELAY);
+        int p = active_plan;
+        if (p < 0) {
+            // Someone else owns the bus now; its frame is unknown to us
+            shown_valid = false;
+            xSemaphoreGive(bus_lock);
+            continue;
+        }
+        uint64_t frame = plans[p][slot];
+        slot = (slot + 1) % DITHER_SLOTS;
+        if (!shown_valid || frame != shown) {
+            tube_bus_write(frame);
+            shown = frame;
+            shown_valid = true;
+            writes++;
+        }
+        xSemaphoreGive(bus_lock);
+
+        int64_t now = esp_timer_get_time();
+        busy_us += now - start;
+        ticks++;
+        if (pending > 1) overruns += pending - 1;
+
+        int64_t window_us = now - window_start;
+        if (window_us >= DITHER_REPORT_US) {
+            // Load in tenths of a percent
+            uint32_t load = (uint32_t)(busy_us * 1000 / window_us);
+            ESP_LOG_LEVEL(
+                load > CONFIG_DITHER_CPU_BUDGET_PCT * 10 ? ESP_LOG_WARN
+                                                         : ESP_LOG_INFO,
+                TAG,
+                "CPU %u.%u%% (budget %d%%), %u slots, %u writes, %u overruns",
+                (unsigned int)(load / 10), (unsigned int)(load % 10),
+                CONFIG_DITHER_CPU_BUDGET_PCT, (unsigned int)ticks,
+                (unsigned int)writes, (unsigned int)overruns);
+            window_start = now;
+            busy_us = 0;
+            ticks = 0;
+            writes = 0;
+            overruns = 0;
+        }
+    }
+}
+
+esp_err_t dither_init(void) {
+    bus_lock = MUTEX_CREATE();
+    if (bus_lock == NULL) return ESP_ERR_NO_MEM;
+
+    if (TASK_CREATE(dither_task, "dither_task", 2048, NULL,
+                    DITHER_TASK_PRIORITY, &dither_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = &slot_timer_cb,
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        .dispatch_method = ESP_TIMER_ISR,
+#endif
+        .name = "dither_slot"};
+    esp_err_t ret = esp_timer_create(&timer_args, &slot_timer);
+    if (ret != ESP_OK) return ret;
+
+    ESP_LOGI(TAG, "%d slots at %d Hz (%d Hz cycle)", DITHER_SLOTS,
+             CONFIG_DITHER_RATE_HZ, CONFIG_DITHER_RATE_HZ / DITHER_SLOTS);
+    return ESP_OK;
+}
+
+/* Set each tube's brightness in percent, relative to the global level on
+~OE. Takes effect with the next frame shown. */
+void dither_set_levels(const uint8_t percent[DISPLAY_TUBES]) {
+    bool full = true;
+
+    portENTER_CRITICAL(&levels_mux);
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        uint8_t p = percent[t] > 100 ? 100 : percent[t];
+        uint8_t slots = (p * DITHER_SLOTS + 50) / 100;
+        // Anything asked to glow at all keeps at least one slot
+        if (slots == 0 && p > 0) slots = 1;
+        tube_slots[t] = slots;
+        full = full && slots == DITHER_SLOTS;
+    }
+    levels_full = full;
+    portEXIT_CRITICAL(&levels_mux);
+}
+
+/* Parse "100,100,50,50,100,100" (left to right). Missing trailing values
+keep their previous content. Returns false if nothing could be read. */
+bool dither_parse_levels(const char* text, uint8_t percent[DISPLAY_TUBES]) {
+    const char* p = text;
+    int t = 0;
+
+    while (t < DISPLAY_TUBES && *p != '\0') {
+        char* end;
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        percent[t++] = (v < 0) ? 0 : (v > 100) ? 100 : v;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return t > 0;
+}
+
+/* Lay out a mix into `plan`. Returns true, with the single frame in
+`steady`, when every slot ends up the same and no dithering is needed. */
+static bool plan_mix(uint64_t plan[DITHER_SLOTS], uint64_t from, uint64_t to,
+                     uint8_t weight, uint64_t* steady) {
+    if (weight >= DITHER_SLOTS) from = to;
+
+    if (levels_full && (from == to || weight == 0)) {
+        *steady = from;
+        return true;
+    }
+
+    build_plan(plan, from, to, weight);
+    for (int s = 1; s < DITHER_SLOTS; s++) {
+        if (plan[s] != plan[0]) return false;
+    }
+    *steady = plan[0];
+    return true;
+}
+
+/* Whether a single frame shows without dithering under the current levels,
+and which bits it then drives. No side effects. */
+bool dither_steady(uint64_t frame, uint64_t* steady) {
+    uint64_t plan[DITHER_SLOTS];
+    return plan_mix(plan, frame, frame, 0, steady);
+}
+
+/* Show `to` for weight/DITHER_SLOTS of the time and `from` for the rest,
+under the per-tube levels. When the result does not need dithering the
+engine is stopped, the single frame is returned in `steady` and the caller
+writes it itself; otherwise the new plan is published and true returned. */
+bool dither_show(uint64_t from, uint64_t to, uint8_t weight,
+                 uint64_t* steady) {
+    int next = (active_plan == 0) ? 1 : 0;
+    if (plan_mix(plans[next], from, to, weight, steady)) {
+        dither_stop();
+        return false;
+    }
+
+    active_plan = next;
+    if (!esp_timer_is_active(slot_timer)) {
+        esp_timer_start_periodic(slot_timer, 1000000 / CONFIG_DITHER_RATE_HZ);
+    }
+    return true;
+}
+
+/* Stop dithering and return once no sub-frame is being pushed any more, so
+the caller owns the bus. */
+void dither_stop(void) {
+    if (active_plan < 0) return;
+
+    esp_timer_stop(slot_timer);
+    xSemaphoreTake(bus_lock, portMAX_DELAY);
+    active_plan = -1;
+    xSemaphoreGive(bus_lock);
+}
+
+bool dither_running(void) {
+    return active_plan >= 0;
+}
@@ -0,0 +1,22 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "display.h"
+
+// Sub-frames per dither cycle. Crossfade weights and per-tube levels are
+// expressed in these units.
+#define DITHER_SLOTS 16
+
+esp_err_t dither_init(void);
+void dither_set_levels(const uint8_t percent[DISPLAY_TUBES]);
+bool dither_parse_levels(const char* text, uint8_t percent[DISPLAY_TUBES]);
+bool dither_steady(uint64_t frame, uint64_t* steady);
+bool dither_show(uint64_t from, uint64_t to, uint8_t weight, uint64_t* steady);
+void dither_stop(void);
+bool dither_running(void);
+
+#endif /* DITHER_H */
@@ -0,0 +1,10 @@
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+
+#include <stdint.h>
+
+static inline uint32_t esp_cpu_get_cycle_count(void) {
+    return 0;
+}
+
+#endif /* ESP_CPU_H */
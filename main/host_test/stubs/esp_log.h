@@ -0,0 +1,12 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+// Logging is dropped; the arguments are still evaluated
+static inline void esp_log_stub(const char* tag, const char* fmt, ...) {}
+
+#define ESP_LOGE(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+
+#endif /* ESP_LOG_H */
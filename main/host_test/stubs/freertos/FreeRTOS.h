@@ -0,0 +1,19 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/* Just enough of FreeRTOS for single-threaded host tests: mutexes always
+succeed and tasks are never created. */
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)-1)
+
+#endif /* FREERTOS_H */
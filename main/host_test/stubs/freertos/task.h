@@ -0,0 +1,14 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))  // One tick per millisecond
+
+static inline void vTaskDelay(TickType_t ticks) {
+    usleep(ticks * 1000);
+}
+
+#endif /* TASK_H */
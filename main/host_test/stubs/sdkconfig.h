@@ -0,0 +1,10 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// The defaults from Kconfig.projbuild that the host-tested sources use
+#define CONFIG_TZ_TABLE_YEARS 4
+#define CONFIG_STATIC_ALLOC 0
+#define CONFIG_WALLCLOCK_BENCHMARK 0
+#define CONFIG_NTP_BURST_SAMPLES 4
+
+#endif /* SDKCONFIG_H */
@@ -0,0 +1,159 @@
+/* Host test of the clock discipline: a simulated local clock that drifts
+against a server seen through a jittery network, polled and corrected the
+way sntp.c does it. Checks that freq_ppb converges on the drift and that
+the clock is never stepped once synced. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "discipline.h"
+
+#define TICK_S 16  // As DISC_TICK_S in sntp.c
+#define MIN_POLL 6
+#define MAX_POLL 10
+#define STEP_US (128 * 1000LL)
+#define BURST 4
+#define BASE_DELAY_US 20000
+#define SIM_DAYS 3
+// freq_ppb is averaged over the last day and checked against the drift
+#define FREQ_TOLERANCE_PPB 1000
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+static uint32_t rng_state;
+
+// Deterministic, so a failure reproduces
+static uint32_t rng(void) {
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state >> 8;
+}
+
+static int64_t uniform(int64_t max) {
+    return max == 0 ? 0 : (int64_t)(rng() % (uint32_t)max);
+}
+
+/* One query: the queueing delay each way is random up to `jitter_us`, and
+the offset is off by half the asymmetry, as with a real server. */
+static disc_sample_t sample(int64_t error_us, int64_t jitter_us) {
+    int64_t out = uniform(jitter_us);
+    int64_t back = uniform(jitter_us);
+    return (disc_sample_t){.offset_us = error_us + (back - out) / 2,
+                           .delay_us = BASE_DELAY_US + out + back};
+}
+
+/* Run SIM_DAYS with the local clock `drift_ppb` slow, starting `start_us`
+behind the server, and check the result. */
+static void simulate(int32_t drift_ppb, int64_t jitter_us, int64_t start_us) {
+    discipline_t d;
+    discipline_init(&d, 0, MIN_POLL, MAX_POLL, STEP_US);
+    rng_state = (uint32_t)drift_ppb ^ (uint32_t)jitter_us;
+
+    int64_t error_us = start_us;  // Server minus local
+    int64_t drift_residue = 0;    // In 1e-9 us
+    int64_t mono_us = 0;
+    int64_t next_poll_us = 0;
+    int steps = 0;
+    int64_t freq_sum = 0;
+    int64_t freq_n = 0;
+    int64_t max_error_us = 0;
+    const int64_t end_us = SIM_DAYS * 86400 * 1000000LL;
+
+    for (; mono_us < end_us; mono_us += TICK_S * 1000000LL) {
+        int64_t drift = (int64_t)drift_ppb * TICK_S * 1000000LL + drift_residue;
+        error_us += drift / 1000000000LL;
+        drift_residue = drift % 1000000000LL;
+        error_us -= discipline_freq_correction(&d, TICK_S * 1000000LL);
+
+        if (mono_us >= next_poll_us) {
+            disc_sample_t samples[BURST];
+            for (int i = 0; i < BURST; i++) {
+                samples[i] = sample(error_us, jitter_us);
+            }
+            disc_action_t action =
+                discipline_update(&d, samples, BURST, mono_us);
+            // Stepped and slewed offsets are both taken out in full
+            if (action != DISC_IGNORE) error_us -= d.offset_us;
+            if (action == DISC_STEP && mono_us > 0) steps++;
+            next_poll_us = mono_us + (1000000LL << d.poll);
+        }
+
+        if (mono_us >= end_us - 86400 * 1000000LL) {
+            freq_sum += d.freq_ppb;
+            freq_n++;
+            if (llabs(error_us) > max_error_us) max_error_us = llabs(error_us);
+        }
+    }
+
+    int64_t freq = freq_sum / freq_n;
+    printf("drift %+7d ppb, jitter %6lld us: freq %+7lld ppb, poll %4d s, "
+           "jitter %5lld us, worst error %5lld us\n",
+           (int)drift_ppb, (long long)jitter_us, (long long)freq, 1 << d.poll,
+           (long long)d.jitter_us, (long long)max_error_us);
+    CHECK(llabs(freq - drift_ppb) < FREQ_TOLERANCE_PPB,
+          "freq_ppb %lld did not converge on %d", (long long)freq,
+          (int)drift_ppb);
+    CHECK(steps == 0, "%d steps after the first sync", steps);
+    CHECK(max_error_us < STEP_US, "error reached %lld us",
+          (long long)max_error_us);
+}
+
+static void test_select(void) {
+    disc_sample_t samples[] = {
+        {.offset_us = 900, .delay_us = 30000},
+        {.offset_us = 100, .delay_us = 21000},
+        {.offset_us = -700, .delay_us = 25000},
+    };
+    CHECK(discipline_select(samples, 3) == 1, "not the shortest round trip");
+    CHECK(discipline_select(samples, 0) == -1, "empty burst selected");
+}
+
+static void test_spike(void) {
+    discipline_t d;
+    discipline_init(&d, 0, MIN_POLL, MAX_POLL, STEP_US);
+    disc_sample_t s = {.offset_us = 5000000, .delay_us = BASE_DELAY_US};
+    CHECK(discipline_update(&d, &s, 1, 0) == DISC_STEP, "first sync");
+
+    s.offset_us = 1000;
+    CHECK(discipline_update(&d, &s, 1, 64000000) == DISC_SLEW, "slew");
+    s.offset_us = 400000;
+    CHECK(discipline_update(&d, &s, 1, 128000000) == DISC_IGNORE,
+          "single spike not ignored");
+    CHECK(discipline_update(&d, &s, 1, 192000000) == DISC_STEP,
+          "confirmed step not taken");
+}
+
+static void test_poll_limits(void) {
+    discipline_t d;
+    discipline_init(&d, 0, 10, 6, STEP_US);
+    CHECK(d.max_poll == 10, "max_poll %d below min_poll 10", d.max_poll);
+}
+
+int main(void) {
+    test_select();
+    test_poll_limits();
+    test_spike();
+
+    simulate(30000, 10000, 2000000);
+    simulate(-30000, 10000, -2000000);
+    simulate(100000, 1000, 0);
+    simulate(0, 10000, 50000);
+    simulate(-250000, 2000, 30000000);
+
+    if (failures) {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
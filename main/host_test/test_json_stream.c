@@ -0,0 +1,178 @@
+/* Host test of the streaming JSON parser: every document is fed whole,
+one byte at a time and split at every offset, and must give the same
+values each way. Covers escapes and surrogate pairs, the depth limit, the
+number grammar and malformed input. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "json_stream.h"
+
+#define EVENTS_LEN 1024
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+static const char* const type_names[] = {"s", "n", "t", "f", "0"};
+
+/* Each value as "path=type:value;", e.g. "clock/fade_ms=n:300;". */
+static void record(void* ctx, const char* const* path, int depth,
+                   json_stream_type_t type, const char* value) {
+    char* out = ctx;
+    size_t len = strlen(out);
+    for (int i = 0; i < depth; i++) {
+        len += snprintf(out + len, EVENTS_LEN - len, "%s%s", i ? "/" : "",
+                        path[i]);
+    }
+    snprintf(out + len, EVENTS_LEN - len, "=%s:%s;", type_names[type], value);
+}
+
+/* Parse `doc` in pieces starting at each of `cuts`, into `events`. */
+static bool parse(const char* doc, const size_t* cuts, int n_cuts,
+                  char events[EVENTS_LEN]) {
+    json_stream_t js;
+    events[0] = '\0';
+    json_stream_init(&js, record, events);
+
+    size_t len = strlen(doc);
+    size_t from = 0;
+    for (int i = 0; i <= n_cuts; i++) {
+        size_t to = i < n_cuts ? cuts[i] : len;
+        if (json_stream_feed(&js, doc + from, to - from) != ESP_OK) {
+            return false;
+        }
+        from = to;
+    }
+    return json_stream_finish(&js) == ESP_OK;
+}
+
+/* Parse `doc` whole, then byte by byte, then split in two at every offset;
+all must agree with `ok` and, when it parses, with `want`. */
+static void check_doc(const char* doc, bool ok, const char* want) {
+    char whole[EVENTS_LEN];
+    char events[EVENTS_LEN];
+    size_t len = strlen(doc);
+
+    bool parsed = parse(doc, NULL, 0, whole);
+    CHECK(parsed == ok, "%s: %s", doc, ok ? "refused" : "accepted");
+    if (ok && want != NULL) {
+        CHECK(strcmp(whole, want) == 0, "%s: got %s, want %s", doc, whole,
+              want);
+    }
+
+    size_t bytes[256];
+    for (size_t i = 0; i + 1 < len && i < 256; i++) bytes[i] = i + 1;
+    parsed = parse(doc, bytes, len > 1 ? (int)len - 1 : 0, events);
+    CHECK(parsed == ok && (!ok || strcmp(events, whole) == 0),
+          "%s: differs fed byte by byte", doc);
+
+    for (size_t cut = 0; cut <= len; cut++) {
+        parsed = parse(doc, &cut, 1, events);
+        CHECK(parsed == ok && (!ok || strcmp(events, whole) == 0),
+              "%s: differs split at %zu", doc, cut);
+    }
+}
+
+static void test_values(void) {
+    check_doc("{\"clock\":{\"fade_ms\":300,\"colon\":true},\"ntp\":\"a b\"}",
+              true, "clock/fade_ms=n:300;clock/colon=t:true;ntp=s:a b;");
+    check_doc(" [1, -2.5e+3, null, false, {}, []] ", true,
+              "=n:1;=n:-2.5e+3;=0:null;=f:false;");
+    check_doc("42", true, "=n:42;");
+    check_doc("\"top\"", true, "=s:top;");
+    check_doc("{\"a\":[[0.5]],\"b\":0E1}", true, "a//=n:0.5;b=n:0E1;");
+}
+
+static void test_escapes(void) {
+    check_doc("[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"]", true,
+              "=s:\"\\/\b\f\n\r\t;");
+    // One, two and three byte UTF-8, and a surrogate pair to four bytes
+    check_doc("[\"\\u0041\\u00e9\\u20AC\\ud83d\\ude00\"]", true,
+              "=s:A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80;");
+    check_doc("[\"\xc3\xa9 passes through\"]", true,
+              "=s:\xc3\xa9 passes through;");
+
+    check_doc("[\"\\x\"]", false, NULL);
+    check_doc("[\"\\u12G4\"]", false, NULL);
+    check_doc("[\"tab\there\"]", false, NULL);
+    check_doc("[\"open", false, NULL);
+}
+
+static void test_depth(void) {
+    check_doc("[[[[1]]]]", true, "///=n:1;");
+    check_doc("[[[[[1]]]]]", false, NULL);
+    check_doc("{\"a\":{\"b\":{\"c\":{\"d\":{}}}}}", false, NULL);
+}
+
+static void test_numbers(void) {
+    const char* good[] = {"0", "-0", "7", "-12", "1.5", "0.25", "1e5",
+                          "1E-5", "2e+10", "-0.0e0"};
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        char doc[32];
+        char want[48];
+        snprintf(doc, sizeof(doc), "{\"fade\":%s}", good[i]);
+        snprintf(want, sizeof(want), "fade=n:%s;", good[i]);
+        check_doc(doc, true, want);
+    }
+
+    const char* bad[] = {"0x10", "01", "1.", ".5", "-", "+1", "1e", "1e+",
+                         "1e5x", "1.2.3", "2f", "1ee5", "infinity", "nan",
+                         "-infinity", "1_000"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        char doc[32];
+        snprintf(doc, sizeof(doc), "{\"fade\":%s}", bad[i]);
+        check_doc(doc, false, NULL);
+        check_doc(bad[i], false, NULL);
+    }
+
+    // Longer than the value buffer: refused rather than cut short
+    char doc[JSON_STREAM_VALUE_LEN + 8] = "[";
+    memset(doc + 1, '1', JSON_STREAM_VALUE_LEN);
+    strcpy(doc + 1 + JSON_STREAM_VALUE_LEN, "]");
+    check_doc(doc, false, NULL);
+}
+
+static void test_malformed(void) {
+    const char* bad[] = {
+        "",      "{",       "{\"a\":1",   "{\"a\" 1}", "{\"a\":1,}",
+        "[1,]",  "[1 2]",   "{1:2}",     "{\"a\":}",  "]",
+        "[}",    "{\"a\":1]", "tru",       "truex",    "nul",
+        "[01]",  "'a'",     "{} {}",     "true false",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        check_doc(bad[i], false, NULL);
+    }
+
+    // Nothing is accepted after an error, and pos points at it
+    json_stream_t js;
+    char events[EVENTS_LEN] = "";
+    json_stream_init(&js, record, events);
+    CHECK(json_stream_feed(&js, "[1,x", 4) != ESP_OK, "error not reported");
+    CHECK(js.pos == 3, "error at %zu, want 3", js.pos);
+    CHECK(json_stream_feed(&js, "]", 1) != ESP_OK, "fed on after an error");
+    CHECK(json_stream_finish(&js) != ESP_OK, "finished after an error");
+}
+
+int main(void) {
+    test_values();
+    test_escapes();
+    test_depth();
+    test_numbers();
+    test_malformed();
+
+    if (failures) {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
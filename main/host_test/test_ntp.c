@@ -0,0 +1,312 @@
+/* Host test of the NTP client: the packet codec and reply checks on their
+own, then ntp_burst() and ntp_acquire() over loopback UDP against local
+stand-in servers that answer with a set clock offset, or misbehave in the
+ways the client has to reject. */
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ntp_client.h"
+#include "ntp_packet.h"
+
+#define ERA1_UNIX_S 2085978496LL  // 2036-02-07 06:28:16, NTP seconds wrap
+#define OFFSET_TOLERANCE_US 5000
+#define MAX_LOOPBACK_DELAY_US 20000
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+static int64_t now_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void test_codec(void) {
+    const int64_t times[] = {
+        0,                                     // 1970, era 0
+        1700000000LL * 1000000 + 123456,       // 2023
+        (ERA1_UNIX_S - 1) * 1000000 + 999999,  // Last of era 0
+        ERA1_UNIX_S * 1000000,                 // First of era 1
+        2200000000LL * 1000000 + 500000,       // 2039
+        4000000000LL * 1000000 + 1,            // 2096
+    };
+    for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        uint8_t p[NTP_TIMESTAMP_SIZE];
+        ntp_put_time(p, times[i]);
+        int64_t back = ntp_get_time(p);
+        // The 32-bit fraction resolves 233 ps, so at most 1 us is lost
+        CHECK(back <= times[i] && times[i] - back <= 1,
+              "%lld came back as %lld", (long long)times[i], (long long)back);
+    }
+
+    uint8_t p[NTP_TIMESTAMP_SIZE];
+    ntp_put_time(p, ERA1_UNIX_S * 1000000);
+    CHECK(p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 0,
+          "era 1 does not start at NTP second 0");
+}
+
+/* A server's reply to `query`, received at `t2` and sent at `t3`. */
+static void make_reply(uint8_t reply[NTP_PACKET_SIZE],
+                       const uint8_t query[NTP_PACKET_SIZE], int64_t t2,
+                       int64_t t3) {
+    memset(reply, 0, NTP_PACKET_SIZE);
+    reply[0] = (0 << 6) | (4 << 3) | 4;  // LI 0, version 4, mode 4 (server)
+    reply[1] = 2;                        // Stratum
+    memcpy(&reply[24], &query[40], NTP_TIMESTAMP_SIZE);
+    ntp_put_time(&reply[32], t2);
+    ntp_put_time(&reply[40], t3);
+}
+
+static void test_parse(void) {
+    uint8_t query[NTP_PACKET_SIZE];
+    uint8_t sent[NTP_TIMESTAMP_SIZE];
+    uint8_t reply[NTP_PACKET_SIZE];
+    disc_sample_t s;
+    const int64_t t1 = 1700000000LL * 1000000;
+
+    ntp_make_query(query, t1, sent);
+    CHECK(query[0] == 0x23, "query header %02x", query[0]);
+    CHECK(memcmp(sent, &query[40], NTP_TIMESTAMP_SIZE) == 0,
+          "sent is not the transmit timestamp");
+
+    // 10 ms each way, 2 ms in the server, whose clock is 250 ms ahead
+    make_reply(reply, query, t1 + 10000 + 250000, t1 + 12000 + 250000);
+    CHECK(ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1 + 22000, &s),
+          "good reply rejected");
+    // Each timestamp may lose a microsecond to the 32-bit fraction
+    CHECK(llabs(s.offset_us - 250000) <= 1 && llabs(s.delay_us - 20000) <= 1,
+          "offset %lld delay %lld", (long long)s.offset_us,
+          (long long)s.delay_us);
+
+    // A server that takes longer than the round trip would give a negative
+    // delay
+    make_reply(reply, query, t1, t1 + 5000);
+    CHECK(ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1 + 1000, &s) &&
+              s.delay_us == 0,
+          "negative delay not clamped");
+
+    make_reply(reply, query, t1, t1);
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE - 1, sent, t1, t1, &s),
+          "short reply accepted");
+    CHECK(!ntp_parse_reply(reply, -1, sent, t1, t1, &s),
+          "failed receive accepted");
+
+    make_reply(reply, query, t1, t1);
+    reply[0] = (reply[0] & ~0x07) | 3;
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1, &s),
+          "client mode accepted");
+
+    make_reply(reply, query, t1, t1);
+    reply[1] = 0;
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1, &s),
+          "kiss-o'-death accepted");
+
+    make_reply(reply, query, t1, t1);
+    reply[1] = 16;
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1, &s),
+          "stratum 16 accepted");
+
+    make_reply(reply, query, t1, t1);
+    reply[0] |= 3 << 6;
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1, &s),
+          "unsynchronised server accepted");
+
+    make_reply(reply, query, t1, t1);
+    reply[31] ^= 1;
+    CHECK(!ntp_parse_reply(reply, NTP_PACKET_SIZE, sent, t1, t1, &s),
+          "wrong origin accepted");
+}
+
+typedef enum {
+    STANDIN_GOOD,
+    STANDIN_SILENT,
+    STANDIN_KISS,
+    STANDIN_UNSYNCED,
+    STANDIN_WRONG_ORIGIN,
+    STANDIN_SHORT,
+} standin_mode_t;
+
+/* A local NTP server on a loopback port, in its own thread. */
+typedef struct {
+    standin_mode_t mode;
+    int64_t offset_us;  // Its clock minus ours
+    int64_t hold_us;    // Between receiving and answering
+    int sock;
+    volatile int stop;
+    int queries;
+    pthread_t thread;
+} standin_t;
+
+static void* standin_run(void* arg) {
+    standin_t* st = arg;
+    while (!st->stop) {
+        uint8_t query[NTP_PACKET_SIZE];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(st->sock, query, sizeof(query), 0,
+                               (struct sockaddr*)&from, &from_len);
+        if (len != NTP_PACKET_SIZE) continue;
+        st->queries++;
+
+        int64_t t2 = now_us() + st->offset_us;
+        if (st->hold_us > 0) usleep(st->hold_us);
+        uint8_t reply[NTP_PACKET_SIZE];
+        make_reply(reply, query, t2, now_us() + st->offset_us);
+
+        size_t reply_len = sizeof(reply);
+        switch (st->mode) {
+            case STANDIN_SILENT:
+                continue;
+            case STANDIN_KISS:
+                reply[1] = 0;
+                memcpy(&reply[12], "RATE", 4);
+                break;
+            case STANDIN_UNSYNCED:
+                reply[0] |= 3 << 6;
+                break;
+            case STANDIN_WRONG_ORIGIN:
+                reply[24] ^= 0x80;
+                break;
+            case STANDIN_SHORT:
+                reply_len = 40;
+                break;
+            default:
+                break;
+        }
+        sendto(st->sock, reply, reply_len, 0, (struct sockaddr*)&from,
+               from_len);
+    }
+    return NULL;
+}
+
+/* Start a stand-in and point `server` at it, as if it had resolved. */
+static void standin_start(standin_t* st, ntp_server_t* server,
+                          standin_mode_t mode, int64_t offset_us,
+                          int64_t hold_us) {
+    *st = (standin_t){.mode = mode, .offset_us = offset_us,
+                      .hold_us = hold_us};
+    st->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    bind(st->sock, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t addr_len = sizeof(addr);
+    getsockname(st->sock, (struct sockaddr*)&addr, &addr_len);
+    struct timeval poll = {.tv_sec = 0, .tv_usec = 50000};
+    setsockopt(st->sock, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll));
+
+    *server = (ntp_server_t){.addr = addr, .resolved = true};
+    snprintf(server->name, sizeof(server->name), "127.0.0.1:%d",
+             ntohs(addr.sin_port));
+    pthread_create(&st->thread, NULL, standin_run, st);
+}
+
+static void standin_stop(standin_t* st) {
+    st->stop = 1;
+    pthread_join(st->thread, NULL);
+    close(st->sock);
+}
+
+static void test_burst(void) {
+    standin_t st;
+    ntp_server_t server;
+    disc_sample_t samples[DISC_MAX_SAMPLES];
+
+    // The server's processing time must not count as round trip
+    standin_start(&st, &server, STANDIN_GOOD, 1500000, 30000);
+    int n = ntp_burst(&server, samples);
+    standin_stop(&st);
+    CHECK(n == CONFIG_NTP_BURST_SAMPLES, "%d of %d samples", n,
+          CONFIG_NTP_BURST_SAMPLES);
+    CHECK(st.queries == CONFIG_NTP_BURST_SAMPLES, "%d queries", st.queries);
+    for (int i = 0; i < n; i++) {
+        CHECK(llabs(samples[i].offset_us - 1500000) < OFFSET_TOLERANCE_US,
+              "sample %d offset %lld", i, (long long)samples[i].offset_us);
+        CHECK(samples[i].delay_us < MAX_LOOPBACK_DELAY_US,
+              "sample %d delay %lld", i, (long long)samples[i].delay_us);
+    }
+    printf("burst: %d samples, offset %+lld us, delay %lld us\n", n,
+           (long long)samples[0].offset_us, (long long)samples[0].delay_us);
+
+    const standin_mode_t bad[] = {STANDIN_KISS, STANDIN_UNSYNCED,
+                                  STANDIN_WRONG_ORIGIN, STANDIN_SHORT};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        standin_start(&st, &server, bad[i], 0, 0);
+        n = ntp_burst(&server, samples);
+        standin_stop(&st);
+        CHECK(n == 0, "mode %d gave %d samples", (int)bad[i], n);
+        CHECK(st.queries == CONFIG_NTP_BURST_SAMPLES,
+              "mode %d got %d queries", (int)bad[i], st.queries);
+    }
+}
+
+static void test_acquire(void) {
+    standin_t st[3];
+    ntp_server_t servers[3];
+    disc_sample_t sample;
+
+    // Dead and bad servers are passed over
+    standin_start(&st[0], &servers[0], STANDIN_SILENT, 0, 0);
+    standin_start(&st[1], &servers[1], STANDIN_KISS, 0, 0);
+    standin_start(&st[2], &servers[2], STANDIN_GOOD, -250000, 0);
+    int64_t start = now_us();
+    int s = ntp_acquire(servers, 3, &sample);
+    int64_t took = now_us() - start;
+    for (int i = 0; i < 3; i++) standin_stop(&st[i]);
+    CHECK(s == 2, "server %d won", s);
+    CHECK(llabs(sample.offset_us + 250000) < OFFSET_TOLERANCE_US,
+          "offset %lld", (long long)sample.offset_us);
+    CHECK(took < 500000, "took %lld us, not one round trip", (long long)took);
+    CHECK(st[0].queries == 1 && st[1].queries == 1 && st[2].queries == 1,
+          "not one query to each server");
+
+    // The fastest good server wins
+    standin_start(&st[0], &servers[0], STANDIN_GOOD, 1000000, 300000);
+    standin_start(&st[1], &servers[1], STANDIN_GOOD, 2000000, 0);
+    s = ntp_acquire(servers, 2, &sample);
+    for (int i = 0; i < 2; i++) standin_stop(&st[i]);
+    CHECK(s == 1, "server %d won", s);
+    CHECK(llabs(sample.offset_us - 2000000) < OFFSET_TOLERANCE_US,
+          "offset %lld", (long long)sample.offset_us);
+
+    // Nobody answers: gives up after the timeout
+    standin_start(&st[0], &servers[0], STANDIN_SILENT, 0, 0);
+    start = now_us();
+    s = ntp_acquire(servers, 1, &sample);
+    took = now_us() - start;
+    standin_stop(&st[0]);
+    CHECK(s == -1, "silent server %d won", s);
+    CHECK(took >= 900000 && took < 2000000, "timeout took %lld us",
+          (long long)took);
+
+    CHECK(ntp_acquire(servers, 0, &sample) == -1, "no servers, one won");
+}
+
+int main(void) {
+    test_codec();
+    test_parse();
+    test_burst();
+    test_acquire();
+
+    if (failures) {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
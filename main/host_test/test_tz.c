@@ -0,0 +1,164 @@
+/* Host test of the time zone table and the wall-clock calendar, against
+libc's localtime_r() for the same POSIX TZ rules: every second around each
+DST transition and midnight, plus a sample across the years the table
+covers, and the hourly chime target around each transition. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tz.h"
+#include "wallclock.h"
+
+#define WINDOW_S (3 * 3600)  // Checked each second on both sides of an edge
+#define SAMPLE_STRIDE_S 9973  // Prime, so samples drift through the day
+#define CHIME_STRIDE_S 97
+#define SPAN_YEARS 2
+
+static const struct {
+    const char* name;
+    const char* spec;
+} zones[] = {
+    {"Los Angeles", "PST8PDT,M3.2.0,M11.1.0"},
+    {"London", "GMT0BST,M3.5.0/1,M10.5.0"},
+    {"Berlin", "CET-1CEST,M3.5.0,M10.5.0/3"},
+    {"Kolkata", "IST-5:30"},
+    {"Sydney", "AEST-10AEDT,M10.1.0,M4.1.0/3"},
+    {"Lord Howe", "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0"},
+    {"Auckland", "NZST-12NZDT,M9.5.0,M4.1.0/3"},
+};
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+static bool same_tm(const struct tm* a, const struct tm* b) {
+    return a->tm_year == b->tm_year && a->tm_mon == b->tm_mon &&
+           a->tm_mday == b->tm_mday && a->tm_hour == b->tm_hour &&
+           a->tm_min == b->tm_min && a->tm_sec == b->tm_sec &&
+           a->tm_wday == b->tm_wday && a->tm_yday == b->tm_yday &&
+           (a->tm_isdst > 0) == (b->tm_isdst > 0);
+}
+
+static void check_second(const char* zone, time_t t, bool calendar) {
+    struct tm want;
+    localtime_r(&t, &want);
+
+    struct tm got;
+    tz_localtime(t, &got, NULL);
+    CHECK(same_tm(&got, &want), "%s: tz_localtime(%lld) is %02d:%02d:%02d",
+          zone, (long long)t, got.tm_hour, got.tm_min, got.tm_sec);
+
+    if (calendar) {
+        wallclock_at(t, &got);
+        CHECK(same_tm(&got, &want),
+              "%s: wallclock_at(%lld) is %02d:%02d:%02d, want %02d:%02d:%02d",
+              zone, (long long)t, got.tm_hour, got.tm_min, got.tm_sec,
+              want.tm_hour, want.tm_min, want.tm_sec);
+    }
+}
+
+/* The first top of the hour shown after `t`, the slow way. UTC offsets are
+whole minutes, so only whole minutes need to be looked at. */
+static time_t next_hour_libc(time_t t) {
+    for (time_t m = t - t % 60 + 60;; m += 60) {
+        struct tm tm;
+        localtime_r(&m, &tm);
+        if (tm.tm_min == 0 && tm.tm_sec == 0) return m;
+    }
+}
+
+static void check_edge(const char* zone, time_t edge) {
+    // The calendar walks through second by second, as the display does
+    wallclock_invalidate();
+    for (time_t t = edge - WINDOW_S; t < edge + WINDOW_S; t++) {
+        check_second(zone, t, true);
+    }
+
+    for (time_t t = edge - WINDOW_S; t < edge + WINDOW_S;
+         t += CHIME_STRIDE_S) {
+        time_t got = wallclock_next_hour(t);
+        time_t want = next_hour_libc(t);
+        CHECK(got == want, "%s: next hour after %lld is %lld, want %lld",
+              zone, (long long)t, (long long)got, (long long)want);
+    }
+}
+
+static void check_zone(const char* zone, const char* spec, time_t start) {
+    tz_set(spec);
+    time_t end = start + SPAN_YEARS * 365 * 86400LL;
+    int transitions = 0;
+
+    // Each span found is checked at both of its ends
+    for (time_t t = start; t < end;) {
+        struct tm tm;
+        tz_span_t span;
+        tz_localtime(t, &tm, &span);
+        CHECK(span.from <= t && t < span.until, "%s: %lld outside its span",
+              zone, (long long)t);
+        if (span.until >= end) break;
+        check_edge(zone, span.until);
+        transitions++;
+        t = span.until;
+    }
+
+    // Local midnights, which end the calendar's span as well
+    for (time_t t = start; t < end; t += 97 * 86400) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        time_t midnight = t + 86400 - (tm.tm_hour * 3600 + tm.tm_min * 60 +
+                                       tm.tm_sec);
+        check_edge(zone, midnight);
+    }
+
+    wallclock_invalidate();
+    for (time_t t = start; t < end; t += SAMPLE_STRIDE_S) {
+        check_second(zone, t, true);
+    }
+
+    printf("%-12s %-40s %d transitions\n", zone, spec, transitions);
+}
+
+/* A zone change is picked up by the calendar without an invalidate, as
+tz_generation() moves on. */
+static void check_switch(time_t now) {
+    struct tm a;
+    struct tm b;
+    tz_set(zones[0].spec);
+    wallclock_at(now, &a);
+    tz_set(zones[3].spec);
+    wallclock_at(now + 1, &b);
+
+    struct tm want;
+    time_t t = now + 1;
+    localtime_r(&t, &want);
+    CHECK(same_tm(&b, &want), "calendar kept the old zone after tz_set");
+    CHECK(!tz_set(zones[3].spec), "tz_set of the same spec rebuilt");
+}
+
+int main(void) {
+    tz_init();
+    wallclock_init();
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < sizeof(zones) / sizeof(zones[0]); i++) {
+        check_zone(zones[i].name, zones[i].spec, now);
+    }
+    check_switch(now);
+
+    if (failures) {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "json_arena.h"
+
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+
+#include "settings.h"
+#include "static_alloc.h"
+
+#if CONFIG_JSON_ARENA
+
+#define ARENA_ALIGN 8  // For the doubles in cJSON items
+#define BENCH_REQUESTS 10000
+#define BENCH_SURVIVORS 16
+
+static const char* TAG = "json_arena";
+
+static uint8_t arena[CONFIG_JSON_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t used = 0;
+static bool overflowed = false;
+
+/* The task whose cJSON calls use the arena, set while it holds the lock.
+Nested begins by the same task share its arena. */
+static TaskHandle_t owner = NULL;
+static int nesting = 0;
+static SemaphoreHandle_t arena_lock = NULL;
+
+static json_arena_stats_t stats;
+
+static void* arena_malloc(size_t size) {
+    if (owner != xTaskGetCurrentTaskHandle()) return malloc(size);
+
+    size_t start = (used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > sizeof(arena) || size > sizeof(arena) - start) {
+        overflowed = true;
+        return NULL;
+    }
+    used = start + size;
+    return arena + start;
+}
+
+static void arena_free(void* ptr) {
+    // Arena memory is only reclaimed as a whole, by json_arena_end
+    if ((uint8_t*)ptr >= arena && (uint8_t*)ptr < arena + sizeof(arena)) {
+        return;
+    }
+    free(ptr);
+}
+
+void json_arena_begin(void) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (owner == self) {
+        nesting++;
+        return;
+    }
+    xSemaphoreTake(arena_lock, portMAX_DELAY);
+    used = 0;
+    overflowed = false;
+    nesting = 1;
+    owner = self;
+}
+
+void json_arena_end(void) {
+    if (--nesting > 0) return;
+
+    if (used > stats.high_water) stats.high_water = used;
+    if (overflowed) {
+        stats.overflows++;
+        ESP_LOGW(TAG, "A request needed more than the %d byte arena",
+                 CONFIG_JSON_ARENA_SIZE);
+    }
+    owner = NULL;
+    used = 0;
+    xSemaphoreGive(arena_lock);
+}
+
+/* Whether an allocation by this task has failed since json_arena_begin. */
+bool json_arena_overflowed(void) {
+    return owner == xTaskGetCurrentTaskHandle() && overflowed;
+}
+
+void json_arena_get_stats(json_arena_stats_t* out) {
+    *out = stats;
+}
+
+void json_arena_init(void) {
+    arena_lock = MUTEX_CREATE();
+    cJSON_Hooks hooks = {.malloc_fn = arena_malloc, .free_fn = arena_free};
+    cJSON_InitHooks(&hooks);
+
+#if CONFIG_JSON_ARENA_BENCHMARK
+    json_arena_benchmark();
+#endif
+}
+
+/* Render the /data document BENCH_REQUESTS times, on the heap or in the
+arena, while a ring of small allocations of varied sizes outlives each
+render, as sockets and pbufs do across requests. Returns the largest free
+block at the end, with the ring still allocated. */
+static size_t bench_run(bool use_arena, int64_t* us) {
+    void* survivors[BENCH_SURVIVORS] = {NULL};
+    settings_t s;
+    settings_get(&s);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_REQUESTS; i++) {
+        if (use_arena) json_arena_begin();
+        cJSON* json = settings_to_json(&s);
+        char* text = cJSON_PrintUnformatted(json);
+        cJSON_Delete(json);
+
+        int slot = i % BENCH_SURVIVORS;
+        free(survivors[slot]);
+        survivors[slot] = malloc(32 + (i * 37) % 160);
+
+        cJSON_free(text);
+        if (use_arena) json_arena_end();
+    }
+    *us = esp_timer_get_time() - start;
+
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    for (int i = 0; i < BENCH_SURVIVORS; i++) free(survivors[i]);
+    return largest;
+}
+
+void json_arena_benchmark(void) {
+    size_t before = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    int64_t heap_us, arena_us;
+    size_t heap_largest = bench_run(false, &heap_us);
+    size_t arena_largest = bench_run(true, &arena_us);
+
+    ESP_LOGI(TAG,
+             "%d renders of /data, largest free block %u before: heap %lld "
+             "us, %u after; arena %lld us, %u after",
+             BENCH_REQUESTS, (unsigned int)before, heap_us,
+             (unsigned int)heap_largest, arena_us,
+             (unsigned int)arena_largest);
+}
+
+#else
+
+void json_arena_init(void) {}
+void json_arena_begin(void) {}
+void json_arena_end(void) {}
+
+bool json_arena_overflowed(void) {
+    return false;
+}
+
+void json_arena_get_stats(json_arena_stats_t* out) {
+    *out = (json_arena_stats_t){0};
+}
+
+void json_arena_benchmark(void) {}
+
+#endif
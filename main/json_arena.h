@@ -0,0 +1,29 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t high_water;  // Most bytes one request has used
+    uint32_t overflows;   // Requests that ran out of arena
+} json_arena_stats_t;
+
+/* cJSON allocation from one fixed arena per request instead of the heap.
+json_arena_init installs the hooks; between json_arena_begin and
+json_arena_end, cJSON calls from that task bump a pointer through the
+arena, and json_arena_end frees all of it at once. Once the arena is full
+cJSON gets NULL instead of taking more heap, and json_arena_overflowed()
+turns true until json_arena_end, so a handler can answer 500 rather than
+send a document with parts missing. Other tasks, and all tasks without
+CONFIG_JSON_ARENA, keep using the heap. Strings cJSON prints must go back
+through cJSON_free. */
+void json_arena_init(void);
+void json_arena_begin(void);
+void json_arena_end(void);
+bool json_arena_overflowed(void);
+void json_arena_get_stats(json_arena_stats_t* out);
+void json_arena_benchmark(void);
+
+#endif /* JSON_ARENA_H */
@@ -0,0 +1,304 @@
+#include "json_stream.h"
+
+#include <string.h>
+
+enum {
+    ST_VALUE,        // A value
+    ST_FIRST_VALUE,  // After '[': a value or ']'
+    ST_FIRST_KEY,    // After '{': a key or '}'
+    ST_KEY,          // After ',' in an object
+    ST_COLON,
+    ST_NEXT,  // After a value: ',' or the closing bracket
+    ST_STRING,
+    ST_ESCAPE,
+    ST_UNICODE,
+    ST_LITERAL,  // Number, true, false or null
+    ST_DONE,
+    ST_ERROR,
+};
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_literal(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' ||
+           c == '+' || c == '.' || c == 'E';
+}
+
+static void append(json_stream_t* js, char c) {
+    if (js->len < JSON_STREAM_VALUE_LEN - 1) js->value[js->len++] = c;
+}
+
+static void append_utf8(json_stream_t* js, uint32_t cp) {
+    if (cp < 0x80) {
+        append(js, cp);
+    } else if (cp < 0x800) {
+        append(js, 0xc0 | (cp >> 6));
+        append(js, 0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        append(js, 0xe0 | (cp >> 12));
+        append(js, 0x80 | ((cp >> 6) & 0x3f));
+        append(js, 0x80 | (cp & 0x3f));
+    } else {
+        append(js, 0xf0 | (cp >> 18));
+        append(js, 0x80 | ((cp >> 12) & 0x3f));
+        append(js, 0x80 | ((cp >> 6) & 0x3f));
+        append(js, 0x80 | (cp & 0x3f));
+    }
+}
+
+static void emit(json_stream_t* js, json_stream_type_t type) {
+    const char* path[JSON_STREAM_MAX_DEPTH];
+    for (int i = 0; i < js->depth; i++) path[i] = js->keys[i];
+    js->value[js->len] = '\0';
+    js->fn(js->ctx, path, js->depth, type, js->value);
+}
+
+static void end_value(json_stream_t* js) {
+    js->state = js->depth == 0 ? ST_DONE : ST_NEXT;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/* Whether `s` follows the JSON number grammar:
+-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static bool is_number(const char* s) {
+    if (*s == '-') s++;
+    if (*s == '0') {
+        s++;
+    } else if (is_digit(*s)) {
+        while (is_digit(*s)) s++;
+    } else {
+        return false;
+    }
+    if (*s == '.') {
+        s++;
+        if (!is_digit(*s)) return false;
+        while (is_digit(*s)) s++;
+    }
+    if (*s == 'e' || *s == 'E') {
+        s++;
+        if (*s == '+' || *s == '-') s++;
+        if (!is_digit(*s)) return false;
+        while (is_digit(*s)) s++;
+    }
+    return *s == '\0';
+}
+
+static bool end_literal(json_stream_t* js) {
+    js->value[js->len] = '\0';
+    json_stream_type_t type;
+    if (strcmp(js->value, "true") == 0) {
+        type = JSON_STREAM_TRUE;
+    } else if (strcmp(js->value, "false") == 0) {
+        type = JSON_STREAM_FALSE;
+    } else if (strcmp(js->value, "null") == 0) {
+        type = JSON_STREAM_NULL;
+    } else {
+        // A number cut short by the value buffer is refused, not misread
+        if (!is_number(js->value) || js->len == JSON_STREAM_VALUE_LEN - 1) {
+            return false;
+        }
+        type = JSON_STREAM_NUMBER;
+    }
+    emit(js, type);
+    end_value(js);
+    return true;
+}
+
+static bool open_container(json_stream_t* js, char c) {
+    if (js->depth == JSON_STREAM_MAX_DEPTH) return false;
+    js->nesting[js->depth] = c;
+    js->keys[js->depth][0] = '\0';
+    js->depth++;
+    js->state = c == '{' ? ST_FIRST_KEY : ST_FIRST_VALUE;
+    return true;
+}
+
+static void close_container(json_stream_t* js) {
+    js->depth--;
+    end_value(js);
+}
+
+static void begin_string(json_stream_t* js, bool key) {
+    js->in_key = key;
+    js->len = 0;
+    js->high = 0;
+    js->state = ST_STRING;
+}
+
+static void end_string(json_stream_t* js) {
+    if (js->in_key) {
+        char* key = js->keys[js->depth - 1];
+        size_t n = js->len < JSON_STREAM_KEY_LEN - 1 ? js->len
+                                                     : JSON_STREAM_KEY_LEN - 1;
+        memcpy(key, js->value, n);
+        key[n] = '\0';
+        js->state = ST_COLON;
+    } else {
+        emit(js, JSON_STREAM_STRING);
+        end_value(js);
+    }
+}
+
+static bool begin_value(json_stream_t* js, char c) {
+    if (c == '"') {
+        begin_string(js, false);
+    } else if (c == '{' || c == '[') {
+        return open_container(js, c);
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' ||
+               c == 'n') {
+        js->len = 0;
+        append(js, c);
+        js->state = ST_LITERAL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool escape(json_stream_t* js, char c) {
+    static const char from[] = "\"\\/bfnrt";
+    static const char to[] = "\"\\/\b\f\n\r\t";
+    if (c == 'u') {
+        js->code = 0;
+        js->hex_digits = 0;
+        js->state = ST_UNICODE;
+        return true;
+    }
+    const char* p = strchr(from, c);
+    if (p == NULL || c == '\0') return false;
+    append(js, to[p - from]);
+    js->state = ST_STRING;
+    return true;
+}
+
+static bool unicode(json_stream_t* js, char c) {
+    int digit;
+    if (c >= '0' && c <= '9') {
+        digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+    } else {
+        return false;
+    }
+    js->code = (js->code << 4) | digit;
+    if (++js->hex_digits < 4) return true;
+
+    js->state = ST_STRING;
+    if (js->code >= 0xd800 && js->code < 0xdc00) {
+        // Wait for the second half of the pair
+        js->high = js->code;
+    } else if (js->code >= 0xdc00 && js->code < 0xe000 && js->high != 0) {
+        append_utf8(js, 0x10000 + ((uint32_t)(js->high - 0xd800) << 10) +
+                            (js->code - 0xdc00));
+        js->high = 0;
+    } else {
+        append_utf8(js, js->code);
+        js->high = 0;
+    }
+    return true;
+}
+
+static bool step(json_stream_t* js, char c) {
+    if (js->state == ST_LITERAL) {
+        if (is_literal(c)) {
+            append(js, c);
+            return true;
+        }
+        if (!end_literal(js)) return false;
+    }
+
+    switch (js->state) {
+        case ST_STRING:
+            if (c == '"') {
+                end_string(js);
+            } else if (c == '\\') {
+                js->state = ST_ESCAPE;
+            } else if ((unsigned char)c < 0x20) {
+                return false;
+            } else {
+                append(js, c);
+            }
+            return true;
+        case ST_ESCAPE:
+            return escape(js, c);
+        case ST_UNICODE:
+            return unicode(js, c);
+        default:
+            break;
+    }
+
+    if (is_space(c)) return true;
+
+    switch (js->state) {
+        case ST_FIRST_VALUE:
+            if (c == ']') {
+                close_container(js);
+                return true;
+            }
+            return begin_value(js, c);
+        case ST_VALUE:
+            return begin_value(js, c);
+        case ST_FIRST_KEY:
+            if (c == '}') {
+                close_container(js);
+                return true;
+            }
+            // Fall through
+        case ST_KEY:
+            if (c != '"') return false;
+            begin_string(js, true);
+            return true;
+        case ST_COLON:
+            if (c != ':') return false;
+            js->state = ST_VALUE;
+            return true;
+        case ST_NEXT:
+            if (c == ',') {
+                js->state =
+                    js->nesting[js->depth - 1] == '{' ? ST_KEY : ST_VALUE;
+                return true;
+            }
+            if (c != (js->nesting[js->depth - 1] == '{' ? '}' : ']')) {
+                return false;
+            }
+            close_container(js);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void json_stream_init(json_stream_t* js, json_stream_fn_t fn, void* ctx) {
+    memset(js, 0, sizeof(*js));
+    js->fn = fn;
+    js->ctx = ctx;
+    js->state = ST_VALUE;
+}
+
+/* Parse the next `len` bytes of the document. After an error, which comes
+with js->pos at the offending byte, the rest is refused too. */
+esp_err_t json_stream_feed(json_stream_t* js, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (js->state == ST_ERROR || !step(js, data[i])) {
+            js->state = ST_ERROR;
+            return ESP_FAIL;
+        }
+        js->pos++;
+    }
+    return ESP_OK;
+}
+
+/* Check that the document was complete. */
+esp_err_t json_stream_finish(json_stream_t* js) {
+    if (js->state == ST_LITERAL && js->depth == 0 && !end_literal(js)) {
+        js->state = ST_ERROR;
+    }
+    return js->state == ST_DONE ? ESP_OK : ESP_FAIL;
+}
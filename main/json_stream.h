@@ -0,0 +1,52 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_STREAM_MAX_DEPTH 4
+#define JSON_STREAM_KEY_LEN 24     // Longer keys are cut short
+#define JSON_STREAM_VALUE_LEN 128  // As are longer strings
+
+typedef enum {
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,
+    JSON_STREAM_TRUE,
+    JSON_STREAM_FALSE,
+    JSON_STREAM_NULL,
+} json_stream_type_t;
+
+/* Called for each value that is not an object or array, with the `depth`
+keys that lead to it from the top level in `path`; array elements have ""
+as their key. `value` is the unescaped string or the literal's text. */
+typedef void (*json_stream_fn_t)(void* ctx, const char* const* path,
+                                 int depth, json_stream_type_t type,
+                                 const char* value);
+
+typedef struct {
+    json_stream_fn_t fn;
+    void* ctx;
+    uint8_t state;
+    uint8_t depth;
+    bool in_key;
+    char nesting[JSON_STREAM_MAX_DEPTH];  // '{' or '['
+    char keys[JSON_STREAM_MAX_DEPTH][JSON_STREAM_KEY_LEN];
+    char value[JSON_STREAM_VALUE_LEN];
+    uint16_t len;
+    uint8_t hex_digits;
+    uint16_t code;  // Of a \u escape
+    uint16_t high;  // First half of a surrogate pair, or 0
+    size_t pos;     // Bytes consumed, for error messages
+} json_stream_t;
+
+/* A JSON parser that is fed the text in pieces of any size and hands out
+values as it completes them, without building a tree or allocating. It
+holds one key per level and one value, so a document of any length parses
+in the few hundred bytes of the json_stream_t. */
+void json_stream_init(json_stream_t* js, json_stream_fn_t fn, void* ctx);
+esp_err_t json_stream_feed(json_stream_t* js, const char* data, size_t len);
+esp_err_t json_stream_finish(json_stream_t* js);
+
+#endif /* JSON_STREAM_H */
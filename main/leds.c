@@ -6,15 +6,18 @@
 #include <freertos/task.h>
 #include <led_strip_encoder.h>
 #include <math.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include "config.h"
+#include "sched.h"
+#include "settings.h"
+#include "static_alloc.h"
+#include "trace.h"
 
 #define RMT_LED_STRIP_GPIO_NUM 8
 #define EXAMPLE_LED_NUMBERS 6
 #define EXAMPLE_CHASE_SPEED_MS 100
 #define EXAMPLE_CHASE_SPEEDUP_MS 10
+#define SPECTRUM_STEP_MS 40
 
 static const char* TAG = "LED_CORE";
 led_strip_handle_t led_strip;
@@ -78,31 +81,12 @@ void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t* r,
 }
 
 static void apply_color(uint8_t r, uint8_t g, uint8_t b) {
+    TRACE_BEGIN("led refresh");
     for (int i = 0; i < EXAMPLE_LED_NUMBERS; i++) {
         led_strip_set_pixel(led_strip, i, r, g, b);
     }
     led_strip_refresh(led_strip);
-}
-
-static void load_nvs_to_ram(void) {
-    char mode_val[16] = {0};
-    char r_val[4] = {0}, g_val[4] = {0}, b_val[4] = {0};
-
-    // Get Mode
-    read_config_value("led_mode", mode_val, sizeof(mode_val));
-    if (mode_val[0] != '\0') {
-        led_set_ram_mode(mode_val);
-    }
-
-    // Load Colors
-    read_config_value("r", r_val, sizeof(r_val));
-    read_config_value("g", g_val, sizeof(g_val));
-    read_config_value("b", b_val, sizeof(b_val));
-
-    // If the buffer isn't empty, convert and store in RAM
-    if (r_val[0] != '\0') ram_r = atoi(r_val);
-    if (g_val[0] != '\0') ram_g = atoi(g_val);
-    if (b_val[0] != '\0') ram_b = atoi(b_val);
+    TRACE_END("led refresh");
 }
 
 void led_send_msg(led_msg_type_t type, uint8_t r, uint8_t g, uint8_t b) {
@@ -114,6 +98,7 @@ void led_send_msg(led_msg_type_t type, uint8_t r, uint8_t g, uint8_t b) {
 static void internal_slot_machine_lights(void) {
     uint32_t r, g, b;
     uint16_t hue = 0, start_rgb = 0;
+    TRACE_BEGIN("led chase");
     for (int loop = 0; loop < 2; loop++) {
         int delay =
             (loop == 0) ? EXAMPLE_CHASE_SPEED_MS : EXAMPLE_CHASE_SPEEDUP_MS;
@@ -134,16 +119,17 @@ static void internal_slot_machine_lights(void) {
             start_rgb += 60;
         }
     }
+    TRACE_END("led chase");
+
     // After slot-machine, return to the RAM colors
     apply_color(ram_r, ram_g, ram_b);
 }
 
 void led_task(void* pvParameters) {
     led_msg_t msg;
-    led_queue = xQueueCreate(10, sizeof(led_msg_t));
+    led_queue = QUEUE_CREATE(10, sizeof(led_msg_t));
 
-    // Initial boot load
-    load_nvs_to_ram();
+    // The settings are in RAM since configure_leds
     apply_color(ram_r, ram_g, ram_b);
 
     while (1) {
@@ -180,28 +166,37 @@ void led_task(void* pvParameters) {
     }
 }
 
-void led_mode_task(void* pvParameters) {
-    bool was_spectrum = false;
-    while (1) {
-        if (strcmp(current_led_mode, "spectrum") == 0) {
-            led_send_msg(LED_CMD_SPECTRUM_STEP, 0, 0, 0);
-            was_spectrum = true;
-            vTaskDelay(pdMS_TO_TICKS(40));
-        } else {
-            if (was_spectrum) {
-                led_send_msg(LED_CMD_RELOAD_CONFIG, 0, 0, 0);
-                was_spectrum = false;
-            }
-            vTaskDelay(pdMS_TO_TICKS(200));
-        }
+static void spectrum_step(void* arg) {
+    if (strcmp(current_led_mode, "spectrum") == 0) {
+        led_send_msg(LED_CMD_SPECTRUM_STEP, 0, 0, 0);
     }
 }
 
+static sched_job_t spectrum_job = SCHED_JOB_INIT(spectrum_step, NULL);
+
 void led_set_ram_mode(const char* mode) {
     if (mode == NULL) return;
     strncpy(current_led_mode, mode, sizeof(current_led_mode) - 1);
     current_led_mode[sizeof(current_led_mode) - 1] = '\0';
     ESP_LOGI(TAG, "Mode set to: %s", current_led_mode);
+
+    // The spectrum steps run on the scheduler only while the mode is on
+    if (strcmp(current_led_mode, "spectrum") == 0) {
+        if (!sched_armed(&spectrum_job)) {
+            sched_every(&spectrum_job, SPECTRUM_STEP_MS);
+        }
+    } else if (sched_armed(&spectrum_job)) {
+        sched_cancel(&spectrum_job);
+        led_send_msg(LED_CMD_RELOAD_CONFIG, 0, 0, 0);
+    }
+}
+
+/* Mode and color from the settings, at boot and when they change. A refresh
+also undoes the previews that /rgb and /led_mode make around the store. */
+static void apply_settings(const settings_t* s, uint32_t changed) {
+    led_set_ram_mode(s->led.mode);
+    led_set_ram_color(s->led.r, s->led.g, s->led.b);
+    led_send_msg(LED_CMD_RELOAD_CONFIG, 0, 0, 0);
 }
 
 void configure_leds(void) {
@@ -214,4 +209,9 @@ void configure_leds(void) {
     led_strip_rmt_config_t rmt_config = {.resolution_hz = 10 * 1000 * 1000};
     ESP_ERROR_CHECK(
         led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip));
+
+    settings_t settings;
+    settings_get(&settings);
+    apply_settings(&settings, SETTINGS_LED);
+    settings_subscribe(SETTINGS_LED, apply_settings);
 }
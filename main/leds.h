@@ -25,7 +25,6 @@ extern QueueHandle_t led_queue;
 
 void configure_leds(void);
 void led_task(void* pvParameters);
-void led_mode_task(void* pvParameters);
 void led_send_msg(led_msg_type_t type, uint8_t r, uint8_t g, uint8_t b);
 void led_set_ram_color(uint8_t r, uint8_t g, uint8_t b);
 void led_set_ram_mode(const char* mode);
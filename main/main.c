@@ -1,33 +1,31 @@
 #include <driver/gpio.h>
 #include <esp_log.h>
 #include <esp_netif.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
-#include <string.h>
 #include <time.h>
 
+#include "alloc_stats.h"
 #include "audio.h"
 #include "clock.h"
 #include "config.h"
+#include "json_arena.h"
 #include "leds.h"
+#include "sched.h"
+#include "settings.h"
 #include "sntp.h"
+#include "static_alloc.h"
+#include "timekeep.h"
+#include "tz.h"
 #include "vfs.h"
+#include "wallclock.h"
 #include "wifi_prov.h"
 #include "ws_server.h"
 
 #define HVEN GPIO_NUM_7
 static const char* TAG = "main";
 
-TaskHandle_t led_slot_machine_task_handle = NULL;
 TaskHandle_t play_audio_task_handle = NULL;
-TaskHandle_t led_mode_task_handle = NULL;
-
-void led_slot_machine_task(void* pvParameters) {
-    while (1) {
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        ESP_LOGI(TAG, "LED Slot Triggered");
-        led_send_msg(LED_CMD_SLOT_MODE, 0, 0, 0);
-    }
-}
 
 void play_audio_task(void* pvParameters) {
     while (1) {
@@ -37,28 +35,21 @@ void play_audio_task(void* pvParameters) {
     }
 }
 
-void hourly_task(void* pvParameters) {
-    while (1) {
-        time_t now;
-        struct tm timeinfo;
-
-        time(&now);
-        localtime_r(&now, &timeinfo);
-
-        int seconds_until_next_hour =
-            (60 - timeinfo.tm_min) * 60 - timeinfo.tm_sec;
-        if (seconds_until_next_hour <= 0) seconds_until_next_hour = 3600;
-        vTaskDelay(pdMS_TO_TICKS(seconds_until_next_hour * 1000));
-        ESP_LOGI(TAG, "Hour changed!");
-
-        // /* DEBUG: Trigger every minute */
-        // int seconds_until_next_minute = 60 - timeinfo.tm_sec;
-        // if (seconds_until_next_minute <= 0) seconds_until_next_minute = 60;
+/* Runs on the scheduler at every top of the hour, by the local clock: the
+rule finds the next one afresh each time, so DST changes move it. */
+static void hourly_chime(void* arg) {
+    ESP_LOGI(TAG, "Hour changed!");
+    clock_send_slot_machine_with_leds();
+}
 
-        // vTaskDelay(pdMS_TO_TICKS(seconds_until_next_minute * 1000));
+static sched_job_t hourly_job = SCHED_JOB_INIT(hourly_chime, NULL);
 
-        clock_send_slot_machine_with_leds();
-    }
+/* Wi-Fi and SNTP can take many seconds, or forever without an access point,
+so they come up here while the display already shows the restored time. */
+static void network_task(void* pvParameters) {
+    wifi_prov_init();
+    sync_sntp();
+    vTaskDelete(NULL);
 }
 
 void app_main(void) {
@@ -69,27 +60,23 @@ void app_main(void) {
         ESP_ERROR_CHECK(nvs_flash_init());
     }
 
+    // Best estimate of the time before anything reads it
+    timekeep_restore();
+    tz_init();
+    sched_init();
+
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(vfs_init());
     ESP_ERROR_CHECK(esp_netif_init());
 
     config_init();
+    settings_init();
 
-    // Sync LED mode from config to RAM
-    char saved_mode[16] = {0};
-    read_config_value("led_mode", saved_mode, sizeof(saved_mode));
-
-    if (strlen(saved_mode) > 0) {
-        led_set_ram_mode(saved_mode);
-    } else {
-        led_set_ram_mode("static");
-    }
-
-    wifi_prov_init();
-    sync_sntp();
+    sntp_load_timezone();
+    sntp_init();
 
     configure_leds();
-    clock_init();  // IMPORTANT: Initialize clock BEFORE hourly task
+    clock_init();  // IMPORTANT: Initialize clock BEFORE hourly chime
 
     // High Voltage Enable
     gpio_config_t io_conf = {.intr_type = GPIO_INTR_DISABLE,
@@ -99,19 +86,21 @@ void app_main(void) {
                              .pull_up_en = 0};
     gpio_config(&io_conf);
     gpio_set_level(HVEN, 1);
+    ESP_LOGI(TAG, "Tubes powered %lld ms after boot",
+             esp_timer_get_time() / 1000);
+
+    TASK_CREATE(network_task, "Network", 4096, NULL, 2, NULL);
 
+    json_arena_init();
     ESP_ERROR_CHECK(start_webserver());
     ESP_ERROR_CHECK(audio_play_start());
 
     // Create Tasks
-    xTaskCreate(led_task, "LED Master", 4096, NULL, 5, NULL);
-    xTaskCreate(led_mode_task, "LED Mode", 2048, NULL, 2,
-                &led_mode_task_handle);
-    xTaskCreate(led_slot_machine_task, "Slot Trigger", 2048, NULL, 3,
-                &led_slot_machine_task_handle);
-    xTaskCreate(play_audio_task, "Play Audio", 4096, NULL, 4,
+    TASK_CREATE(led_task, "LED Master", 4096, NULL, 5, NULL);
+    TASK_CREATE(play_audio_task, "Play Audio", 4096, NULL, 4,
                 &play_audio_task_handle);
-    xTaskCreate(hourly_task, "Hourly", 2048, NULL, 1, NULL);
+    sched_rule(&hourly_job, wallclock_next_hour);
+    alloc_stats_init();
 
     ESP_LOGI(TAG, "System initialization complete");
 }
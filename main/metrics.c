@@ -0,0 +1,240 @@
+#include "metrics.h"
+
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "alloc_stats.h"
+#include "json_arena.h"
+#include "resp_buf.h"
+#include "settings.h"
+#include "sntp.h"
+#include "vfs.h"
+
+#define METRICS_MAX_TASKS 32
+
+static const uint32_t bucket_ms[METRICS_BUCKETS] = METRICS_BUCKET_MS;
+
+static void family(resp_buf_t* out, const char* name, const char* type,
+                   const char* help) {
+    resp_buf_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+                    type);
+}
+
+void metrics_observe(metrics_hist_t* hist, int64_t us) {
+    int i = 0;
+    while (i < METRICS_BUCKETS && us > (int64_t)bucket_ms[i] * 1000) i++;
+    hist->counts[i]++;
+    hist->count++;
+    hist->sum_us += us;
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+/* Only the httpd task scrapes, so the snapshots need no lock. The previous
+one turns the run time counters into a share of the time since then. */
+static TaskStatus_t tasks[METRICS_MAX_TASKS];
+static struct {
+    UBaseType_t number;
+    configRUN_TIME_COUNTER_TYPE runtime;
+} prev[METRICS_MAX_TASKS];
+static int prev_count = 0;
+static configRUN_TIME_COUNTER_TYPE prev_total = 0;
+
+static void send_tasks(resp_buf_t* out) {
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    int n = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, &total);
+
+    family(out, "nixie_task_stack_free_min_bytes", "gauge",
+           "Least stack the task has had left (high-water mark)");
+    for (int i = 0; i < n; i++) {
+        resp_buf_printf(out,
+                        "nixie_task_stack_free_min_bytes{task=\"%s\"} %u\n",
+                        tasks[i].pcTaskName,
+                        (unsigned int)tasks[i].usStackHighWaterMark);
+    }
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    family(out, "nixie_task_cpu_percent", "gauge",
+           "Share of CPU time since the previous scrape, or since boot");
+    configRUN_TIME_COUNTER_TYPE elapsed = total - prev_total;
+    for (int i = 0; i < n && elapsed > 0; i++) {
+        configRUN_TIME_COUNTER_TYPE before = 0;
+        for (int j = 0; j < prev_count; j++) {
+            if (prev[j].number == tasks[i].xTaskNumber) {
+                before = prev[j].runtime;
+                break;
+            }
+        }
+        double percent =
+            100.0 * (double)(tasks[i].ulRunTimeCounter - before) / elapsed;
+        resp_buf_printf(out, "nixie_task_cpu_percent{task=\"%s\"} %.2f\n",
+                        tasks[i].pcTaskName, percent);
+    }
+
+    for (int i = 0; i < n; i++) {
+        prev[i].number = tasks[i].xTaskNumber;
+        prev[i].runtime = tasks[i].ulRunTimeCounter;
+    }
+    prev_count = n;
+    prev_total = total;
+#endif
+}
+#endif
+
+static void send_system(resp_buf_t* out) {
+    family(out, "nixie_uptime_seconds", "counter", "Time since boot");
+    resp_buf_printf(out, "nixie_uptime_seconds %.3f\n",
+                    esp_timer_get_time() / 1e6);
+
+    family(out, "nixie_heap_free_bytes", "gauge", "Free heap");
+    resp_buf_printf(out, "nixie_heap_free_bytes %u\n",
+                    (unsigned int)esp_get_free_heap_size());
+    family(out, "nixie_heap_min_free_bytes", "gauge",
+           "Least free heap since boot");
+    resp_buf_printf(out, "nixie_heap_min_free_bytes %u\n",
+                    (unsigned int)esp_get_minimum_free_heap_size());
+    family(out, "nixie_heap_largest_free_block_bytes", "gauge",
+           "Largest block that can be allocated; far below free heap means "
+           "fragmentation");
+    resp_buf_printf(
+        out, "nixie_heap_largest_free_block_bytes %u\n",
+        (unsigned int)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    size_t total = 0, used = 0;
+    if (vfs_usage(&total, &used) == ESP_OK) {
+        family(out, "nixie_fs_size_bytes", "gauge", "Storage partition size");
+        resp_buf_printf(out, "nixie_fs_size_bytes %u\n", (unsigned int)total);
+        family(out, "nixie_fs_used_bytes", "gauge", "Storage space in use");
+        resp_buf_printf(out, "nixie_fs_used_bytes %u\n", (unsigned int)used);
+    }
+
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        family(out, "nixie_wifi_rssi_dbm", "gauge",
+               "Signal strength of the access point");
+        resp_buf_printf(out, "nixie_wifi_rssi_dbm %d\n", ap.rssi);
+    }
+
+    sntp_stats_t stats;
+    sntp_get_stats(&stats);
+    family(out, "nixie_sntp_synced", "gauge", "1 once NTP has set the clock");
+    resp_buf_printf(out, "nixie_sntp_synced %d\n", stats.synced ? 1 : 0);
+    if (stats.synced) {
+        family(out, "nixie_sntp_offset_seconds", "gauge",
+               "Last measured offset of the server time from ours");
+        resp_buf_printf(out, "nixie_sntp_offset_seconds %.6f\n",
+                        stats.offset_us / 1e6);
+        family(out, "nixie_sntp_jitter_seconds", "gauge",
+               "Variation of the measured offsets");
+        resp_buf_printf(out, "nixie_sntp_jitter_seconds %.6f\n",
+                        stats.jitter_us / 1e6);
+    }
+
+    settings_stats_t saves;
+    settings_get_stats(&saves);
+    family(out, "nixie_config_save_requests_total", "counter",
+           "Settings saves asked for");
+    resp_buf_printf(out, "nixie_config_save_requests_total %u\n",
+                    (unsigned int)saves.requests);
+    family(out, "nixie_config_writes_total", "counter",
+           "Writes to NVS those were coalesced into");
+    resp_buf_printf(out, "nixie_config_writes_total %u\n",
+                    (unsigned int)saves.writes);
+    family(out, "nixie_config_write_bytes_total", "counter",
+           "Bytes of settings written to NVS");
+    resp_buf_printf(out, "nixie_config_write_bytes_total %llu\n",
+                    (unsigned long long)saves.bytes);
+    family(out, "nixie_config_write_failures_total", "counter",
+           "Writes of the settings that failed");
+    resp_buf_printf(out, "nixie_config_write_failures_total %u\n",
+                    (unsigned int)saves.failures);
+}
+
+#if CONFIG_ALLOC_STATS
+static alloc_stats_task_t alloc_tasks[ALLOC_STATS_MAX_TASKS];
+
+static void send_allocs(resp_buf_t* out) {
+    int n = alloc_stats_get(alloc_tasks, ALLOC_STATS_MAX_TASKS);
+    family(out, "nixie_heap_allocs_total", "counter",
+           "Heap allocations made by the task since boot");
+    for (int i = 0; i < n; i++) {
+        resp_buf_printf(out, "nixie_heap_allocs_total{task=\"%s\"} %u\n",
+                        alloc_tasks[i].name,
+                        (unsigned int)alloc_tasks[i].allocs);
+    }
+#if CONFIG_ALLOC_STATS_CHECK
+    family(out, "nixie_heap_alloc_violations_total", "counter",
+           "Allocations after boot by tasks that should not allocate");
+    resp_buf_printf(out, "nixie_heap_alloc_violations_total %u\n",
+                    (unsigned int)alloc_stats_violations());
+#endif
+}
+#endif
+
+#if CONFIG_JSON_ARENA
+static void send_arena(resp_buf_t* out) {
+    json_arena_stats_t stats;
+    json_arena_get_stats(&stats);
+    family(out, "nixie_json_arena_high_water_bytes", "gauge",
+           "Most cJSON arena one request has used");
+    resp_buf_printf(out, "nixie_json_arena_high_water_bytes %u\n",
+                    (unsigned int)stats.high_water);
+    family(out, "nixie_json_arena_overflows_total", "counter",
+           "Requests that ran out of cJSON arena");
+    resp_buf_printf(out, "nixie_json_arena_overflows_total %u\n",
+                    (unsigned int)stats.overflows);
+}
+#endif
+
+static void send_latency(resp_buf_t* out, const metrics_hist_t* hists,
+                         int count) {
+    family(out, "nixie_http_request_duration_seconds", "histogram",
+           "Time to handle a request, including sending the response");
+    for (int h = 0; h < count; h++) {
+        const metrics_hist_t* hist = &hists[h];
+        uint32_t cumulative = 0;
+        for (int i = 0; i < METRICS_BUCKETS; i++) {
+            cumulative += hist->counts[i];
+            resp_buf_printf(out,
+                            "nixie_http_request_duration_seconds_bucket"
+                            "{endpoint=\"%s\",le=\"%.3f\"} %u\n",
+                            hist->name, bucket_ms[i] / 1000.0,
+                            (unsigned int)cumulative);
+        }
+        resp_buf_printf(out,
+                        "nixie_http_request_duration_seconds_bucket"
+                        "{endpoint=\"%s\",le=\"+Inf\"} %u\n",
+                        hist->name, (unsigned int)hist->count);
+        resp_buf_printf(out,
+                        "nixie_http_request_duration_seconds_sum"
+                        "{endpoint=\"%s\"} %.6f\n",
+                        hist->name, hist->sum_us / 1e6);
+        resp_buf_printf(out,
+                        "nixie_http_request_duration_seconds_count"
+                        "{endpoint=\"%s\"} %u\n",
+                        hist->name, (unsigned int)hist->count);
+    }
+}
+
+esp_err_t metrics_send(httpd_req_t* req, const metrics_hist_t* hists,
+                       int count) {
+    resp_buf_t out;
+    resp_buf_init(&out, req);
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    send_tasks(&out);
+#endif
+    send_system(&out);
+#if CONFIG_ALLOC_STATS
+    send_allocs(&out);
+#endif
+#if CONFIG_JSON_ARENA
+    send_arena(&out);
+#endif
+    send_latency(&out, hists, count);
+    return resp_buf_finish(&out);
+}
@@ -0,0 +1,25 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <esp_http_server.h>
+#include <stdint.h>
+
+// Latency histogram bucket bounds in ms, plus an implicit +Inf bucket
+#define METRICS_BUCKET_MS {1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500}
+#define METRICS_BUCKETS 10
+
+typedef struct {
+    const char* name;
+    uint32_t counts[METRICS_BUCKETS + 1];  // Not cumulative; last is +Inf
+    uint32_t count;
+    uint64_t sum_us;
+} metrics_hist_t;
+
+/* Prometheus text exposition of the task, heap, filesystem, Wi-Fi and SNTP
+state, plus the given latency histograms. The cost is a task list snapshot
+and the chunk buffer on the stack. */
+void metrics_observe(metrics_hist_t* hist, int64_t us);
+esp_err_t metrics_send(httpd_req_t* req, const metrics_hist_t* hists,
+                       int count);
+
+#endif /* METRICS_H */
@@ -3,53 +3,35 @@
 #include <driver/gpio.h>
 #include <esp_log.h>
 #include <esp_timer.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
-#include <freertos/task.h>
 
-uint32_t counter = 0;
-
-uint32_t last_interrupt_time = 0;
+#include "sched.h"
 
 static const char* TAG = "motion sensor";
 
-static QueueHandle_t gpio_evt_queue = NULL;
+// Milliseconds since boot; 32 bits so the ISR's store is a single write
+static volatile uint32_t last_motion_ms = 0;
 
 static void IRAM_ATTR gpio_isr_handler(void* arg) {
-    uint32_t current_time =
-        esp_timer_get_time() / 1000;  // Get time in milliseconds
-
-    if ((current_time - last_interrupt_time) > DEBOUNCE_DELAY_MS) {
-        last_interrupt_time = current_time;
-        uint32_t gpio_num = (uint32_t)arg;
-        xQueueSendFromISR(gpio_evt_queue, &gpio_num, NULL);
-        counter = 0;
-    }
+    last_motion_ms = esp_timer_get_time() / 1000;
 }
 
-void timer_callback(void* arg) {
-    // Increment counter every second
-    counter++;
-}
-
-void sleep_task(void* pvParameter) {
-    while (1) {
-        // Check if counter reaches half hour (1800 seconds)
-        if (counter >= 1800) {
-            printf("Yo dawg...TODO\n");
-            // TODO - This is where you would put the clock to sleep
-        }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);  // Check every second
+/* Due INACTIVITY_TIMEOUT_S after the last motion known when it was armed.
+Motion since then only moves the deadline, so the ISR never touches the
+scheduler. */
+static void inactivity_check(void* arg);
+static sched_job_t inactivity_job = SCHED_JOB_INIT(inactivity_check, NULL);
+
+static void inactivity_check(void* arg) {
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    uint32_t idle_ms = now_ms - last_motion_ms;
+    if (idle_ms < INACTIVITY_TIMEOUT_S * 1000) {
+        sched_after(&inactivity_job, INACTIVITY_TIMEOUT_S * 1000 - idle_ms);
+        return;
     }
-}
 
-static void gpio_task(void* arg) {
-    uint32_t io_num;
-    for (;;) {
-        if (xQueueReceive(gpio_evt_queue, &io_num, portMAX_DELAY)) {
-            ESP_LOGI(TAG, "Motion detected on GPIO %u", (unsigned int)io_num);
-        }
-    }
+    ESP_LOGI(TAG, "No motion for %u s", (unsigned int)(idle_ms / 1000));
+    // TODO - This is where you would put the clock to sleep
+    sched_after(&inactivity_job, INACTIVITY_TIMEOUT_S * 1000);
 }
 
 void motion_init(void) {
@@ -62,29 +44,12 @@ void motion_init(void) {
     io_conf.pin_bit_mask = (1ULL << GPIO_MOTION_INTR_PIN);
     gpio_config(&io_conf);
 
-    // create a queue to handle gpio event from isr
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
-
-    // //start gpio task
-    xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, NULL);
-
     // install gpio isr service
     gpio_install_isr_service(0);
     // hook isr handler for specific gpio pin
     gpio_isr_handler_add(GPIO_MOTION_INTR_PIN, gpio_isr_handler,
                          (void*)GPIO_MOTION_INTR_PIN);
 
-    // printf("Minimum free heap size: %"PRIu32" bytes\n",
-    // esp_get_minimum_free_heap_size());
-
-    // Create and start timer
-    esp_timer_handle_t timer;
-    esp_timer_create_args_t timer_args = {.callback = &timer_callback,
-                                          .name = "periodic_timer"};
-    esp_timer_create(&timer_args, &timer);
-    esp_timer_start_periodic(
-        timer, TIMER_INTERVAL * 1000);  // Timer interval in microseconds
-
-    // Create task to monitor counter
-    xTaskCreate(&sleep_task, "sleep_task", 4096, NULL, 5, NULL);
-}
\ No newline at end of file
+    last_motion_ms = esp_timer_get_time() / 1000;
+    sched_after(&inactivity_job, INACTIVITY_TIMEOUT_S * 1000);
+}
@@ -1,8 +1,7 @@
 #ifndef MOTION_H
 #define MOTION_H
 
-#define DEBOUNCE_DELAY_MS 1000  // 1 second, very sensitive GPIO
-#define TIMER_INTERVAL 1000     // 1 second
+#define INACTIVITY_TIMEOUT_S 1800  // Half an hour
 #define GPIO_MOTION_INTR_PIN GPIO_NUM_10
 
 void motion_init(void);
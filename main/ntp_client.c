@@ -0,0 +1,145 @@
+#include "ntp_client.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/netdb.h>
+#include <sdkconfig.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ntp_packet.h"
+
+#define NTP_PORT "123"
+#define NTP_TIMEOUT_MS 1000
+#define NTP_BURST_GAP_MS 500
+
+static const char* TAG = "ntp_client";
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static bool resolve(ntp_server_t* server) {
+    if (server->resolved) return true;
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(server->name, NTP_PORT, &hints, &res) != 0 ||
+        res == NULL) {
+        ESP_LOGW(TAG, "Cannot resolve %s", server->name);
+        return false;
+    }
+    memcpy(&server->addr, res->ai_addr, sizeof(server->addr));
+    freeaddrinfo(res);
+    server->resolved = true;
+    return true;
+}
+
+/* UDP socket connected to `server`, with receive timeout. -1 on failure. */
+static int open_socket(ntp_server_t* server) {
+    if (!resolve(server)) return -1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = NTP_TIMEOUT_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr*)&server->addr, sizeof(server->addr)) !=
+        0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Send a client request. Its transmit time goes to `sent` (as sent, for the
+origin check) and `t1`. */
+static bool send_query(int sock, uint8_t sent[NTP_TIMESTAMP_SIZE],
+                       int64_t* t1) {
+    uint8_t pkt[NTP_PACKET_SIZE];
+    *t1 = wall_us();
+    ntp_make_query(pkt, *t1, sent);
+    return send(sock, pkt, sizeof(pkt), 0) == sizeof(pkt);
+}
+
+/* Receive and check the reply to a request sent at `t1`. */
+static bool read_reply(int sock, const uint8_t sent[NTP_TIMESTAMP_SIZE],
+                       int64_t t1, disc_sample_t* out) {
+    uint8_t pkt[NTP_PACKET_SIZE];
+    int len = recv(sock, pkt, sizeof(pkt), 0);
+    int64_t t4 = wall_us();
+    return ntp_parse_reply(pkt, len, sent, t1, t4, out);
+}
+
+/* Query `server` CONFIG_NTP_BURST_SAMPLES times. Returns the number of good
+samples. */
+int ntp_burst(ntp_server_t* server, disc_sample_t* samples) {
+    int sock = open_socket(server);
+    if (sock < 0) return 0;
+
+    int n = 0;
+    for (int i = 0; i < CONFIG_NTP_BURST_SAMPLES; i++) {
+        uint8_t sent[NTP_TIMESTAMP_SIZE];
+        int64_t t1;
+        if (i > 0) vTaskDelay(pdMS_TO_TICKS(NTP_BURST_GAP_MS));
+        if (send_query(sock, sent, &t1) &&
+            read_reply(sock, sent, t1, &samples[n])) {
+            n++;
+        }
+    }
+    close(sock);
+    return n;
+}
+
+/* Query all `count` servers at once and take the first good answer, so the
+first sync costs one round trip to the fastest server rather than a timeout
+per dead one. Returns the index of the server that answered, or -1. */
+int ntp_acquire(ntp_server_t* servers, int count, disc_sample_t* sample) {
+    int socks[SNTP_MAX_SERVERS];
+    uint8_t sent[SNTP_MAX_SERVERS][NTP_TIMESTAMP_SIZE];
+    int64_t t1[SNTP_MAX_SERVERS];
+    int winner = -1;
+
+    fd_set open_set;
+    FD_ZERO(&open_set);
+    int max_fd = -1;
+    for (int i = 0; i < count; i++) {
+        socks[i] = open_socket(&servers[i]);
+        if (socks[i] < 0) continue;
+        if (!send_query(socks[i], sent[i], &t1[i])) {
+            close(socks[i]);
+            socks[i] = -1;
+            continue;
+        }
+        FD_SET(socks[i], &open_set);
+        if (socks[i] > max_fd) max_fd = socks[i];
+    }
+
+    int64_t deadline = esp_timer_get_time() + NTP_TIMEOUT_MS * 1000LL;
+    while (winner < 0 && max_fd >= 0) {
+        int64_t left = deadline - esp_timer_get_time();
+        if (left <= 0) break;
+        struct timeval tv = {.tv_sec = left / 1000000,
+                             .tv_usec = left % 1000000};
+        fd_set ready = open_set;
+        if (select(max_fd + 1, &ready, NULL, NULL, &tv) <= 0) break;
+
+        for (int i = 0; i < count && winner < 0; i++) {
+            if (socks[i] < 0 || !FD_ISSET(socks[i], &ready)) continue;
+            if (read_reply(socks[i], sent[i], t1[i], sample)) {
+                winner = i;
+            } else {
+                // Bad answer: stop listening to this one
+                FD_CLR(socks[i], &open_set);
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (socks[i] >= 0) close(socks[i]);
+    }
+    return winner;
+}
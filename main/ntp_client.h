@@ -0,0 +1,26 @@
+#ifndef NTP_CLIENT_H
+#define NTP_CLIENT_H
+
+#include <lwip/sockets.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "discipline.h"
+#include "sntp.h"
+
+typedef struct {
+    char name[SNTP_SERVER_NAME_LEN];
+    struct sockaddr_in addr;
+    bool resolved;
+    uint8_t reach;  // One bit per poll, newest in bit 0: 1 = answered
+    uint8_t idle;   // Polls since last used
+    int64_t delay_us;
+} ntp_server_t;
+
+/* The UDP side of the NTP client: queries and replies over plain BSD
+sockets, which lwIP provides on the device and the host has natively. A
+server is resolved on first use and again after `resolved` is cleared. */
+int ntp_burst(ntp_server_t* server, disc_sample_t* samples);
+int ntp_acquire(ntp_server_t* servers, int count, disc_sample_t* sample);
+
+#endif /* NTP_CLIENT_H */
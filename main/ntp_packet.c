@@ -0,0 +1,58 @@
+#include "ntp_packet.h"
+
+#include <string.h>
+
+#define NTP_TO_UNIX_S 2208988800LL  // 1900 to 1970
+#define NTP_ORIGIN 24
+#define NTP_RECEIVE 32
+#define NTP_TRANSMIT 40
+
+void ntp_put_time(uint8_t* p, int64_t unix_us) {
+    uint32_t sec = (uint32_t)(unix_us / 1000000 + NTP_TO_UNIX_S);
+    uint32_t frac = (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = sec >> (24 - 8 * i);
+        p[4 + i] = frac >> (24 - 8 * i);
+    }
+}
+
+int64_t ntp_get_time(const uint8_t* p) {
+    uint32_t sec = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    uint32_t frac = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    // Era 1 starts in 2036; anything with the top bit clear is from there
+    int64_t s = (int64_t)sec - NTP_TO_UNIX_S;
+    if ((sec & 0x80000000u) == 0) s += 1LL << 32;
+    return s * 1000000 + (((uint64_t)frac * 1000000) >> 32);
+}
+
+/* A client request sent at `t1_us`. Its transmit timestamp also goes to
+`sent`, for the origin check of the reply. */
+void ntp_make_query(uint8_t pkt[NTP_PACKET_SIZE], int64_t t1_us,
+                    uint8_t sent[NTP_TIMESTAMP_SIZE]) {
+    memset(pkt, 0, NTP_PACKET_SIZE);
+    pkt[0] = 0x23;  // LI 0, version 4, mode 3 (client)
+    ntp_put_time(&pkt[NTP_TRANSMIT], t1_us);
+    memcpy(sent, &pkt[NTP_TRANSMIT], NTP_TIMESTAMP_SIZE);
+}
+
+/* Check a reply of `len` bytes received at `t4_us` to the request sent at
+`t1_us`, and work out the sample. The reply must echo our transmit time as
+its origin time, which drops stale and spoofed replies. */
+bool ntp_parse_reply(const uint8_t* pkt, int len,
+                     const uint8_t sent[NTP_TIMESTAMP_SIZE], int64_t t1_us,
+                     int64_t t4_us, disc_sample_t* out) {
+    if (len < NTP_PACKET_SIZE) return false;
+    uint8_t li = pkt[0] >> 6;
+    uint8_t mode = pkt[0] & 0x07;
+    uint8_t stratum = pkt[1];
+    // Stratum 0 is a kiss-o'-death, LI 3 an unsynchronised server
+    if (mode != 4 || stratum == 0 || stratum > 15 || li == 3) return false;
+    if (memcmp(&pkt[NTP_ORIGIN], sent, NTP_TIMESTAMP_SIZE) != 0) return false;
+
+    int64_t t2 = ntp_get_time(&pkt[NTP_RECEIVE]);
+    int64_t t3 = ntp_get_time(&pkt[NTP_TRANSMIT]);
+    out->offset_us = ((t2 - t1_us) + (t3 - t4_us)) / 2;
+    out->delay_us = (t4_us - t1_us) - (t3 - t2);
+    if (out->delay_us < 0) out->delay_us = 0;
+    return true;
+}
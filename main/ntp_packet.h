@@ -0,0 +1,24 @@
+#ifndef NTP_PACKET_H
+#define NTP_PACKET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "discipline.h"
+
+#define NTP_PACKET_SIZE 48
+#define NTP_TIMESTAMP_SIZE 8
+
+/* NTPv4 packets as the client sends and checks them. Pure arithmetic on
+byte buffers with no platform dependencies, so it also builds on a host.
+Times are Unix microseconds; NTP timestamps of era 1 (2036 on) are told
+from era 0 by their top bit, which holds until 2104. */
+void ntp_put_time(uint8_t* p, int64_t unix_us);
+int64_t ntp_get_time(const uint8_t* p);
+void ntp_make_query(uint8_t pkt[NTP_PACKET_SIZE], int64_t t1_us,
+                    uint8_t sent[NTP_TIMESTAMP_SIZE]);
+bool ntp_parse_reply(const uint8_t* pkt, int len,
+                     const uint8_t sent[NTP_TIMESTAMP_SIZE], int64_t t1_us,
+                     int64_t t4_us, disc_sample_t* out);
+
+#endif /* NTP_PACKET_H */
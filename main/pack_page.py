@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Build the page the web server sends for "/".
+
+Minifies styles.css, iro.min.js, settings.js and body.html, joins them into
+one HTML document, and writes it gzip-compressed along with its ETag, a
+hash of the content. Run by the build:
+
+    pack_page.py OUT_GZ OUT_ETAG STYLES_CSS IRO_JS SETTINGS_JS BODY_HTML
+
+The minification is conservative: it drops comments, indentation and blank
+lines but keeps every line break, which gzip makes nearly free anyway.
+"""
+
+import gzip
+import hashlib
+import re
+import sys
+
+HEAD = (
+    '<!DOCTYPE html><html><head><meta charset="UTF-8">'
+    '<meta name="viewport" content="width=device-width, initial-scale=1.0, '
+    'maximum-scale=1, user-scalable=0">'
+    "<title>Wi-Fi Nixie Clock</title>"
+)
+
+
+def strip_lines(text):
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def minify_css(text):
+    return strip_lines(re.sub(r"/\*.*?\*/", "", text, flags=re.S))
+
+
+def minify_html(text):
+    return strip_lines(re.sub(r"<!--.*?-->", "", text, flags=re.S))
+
+
+def minify_js(text):
+    """Strip lines, except inside template literals, and drop whole-line //
+    comments."""
+    out = []
+    in_template = False
+    for line in text.splitlines():
+        if not in_template:
+            line = line.strip()
+            if not line or line.startswith("//"):
+                continue
+        out.append(line)
+        if len(re.findall(r"(?<!\\)`", line)) % 2:
+            in_template = not in_template
+    return "\n".join(out)
+
+
+def main():
+    out_gz, out_etag, css, iro, settings, body = sys.argv[1:7]
+
+    def read(path):
+        with open(path, encoding="utf-8") as f:
+            return f.read()
+
+    page = (
+        HEAD
+        + "<style>" + minify_css(read(css)) + "</style>"
+        + "<script>" + read(iro).strip() + "</script>"
+        + "<script>" + minify_js(read(settings)) + "</script>"
+        + "</head>" + minify_html(read(body)) + "</html>"
+    ).encode("utf-8")
+
+    # No timestamp in the header, so the same sources give the same bytes
+    compressed = gzip.compress(page, compresslevel=9, mtime=0)
+    etag = '"' + hashlib.sha256(page).hexdigest()[:16] + '"'
+
+    with open(out_gz, "wb") as f:
+        f.write(compressed)
+    with open(out_etag, "w", encoding="ascii") as f:
+        f.write(etag)
+
+    paths = (css, iro, settings, body)
+    sources = sum(len(read(p).encode("utf-8")) for p in paths)
+    print(
+        "Web page: %d bytes of sources, %d minified, %d gzipped, ETag %s"
+        % (sources, len(page), len(compressed), etag)
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,150 @@
+#include "reel.h"
+
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define REEL_FRAME_MS 20
+#define REEL_EASE_STEPS 256
+
+static const char* TAG = "reel";
+
+typedef struct {
+    uint8_t start;        // Digit showing when the reel starts
+    uint16_t distance;    // Digits travelled, ends on the target
+    uint16_t land_frame;  // First frame the tube shows the time again
+} reel_t;
+
+static reel_t reels[DISPLAY_TUBES];
+static uint8_t targets[DISPLAY_TUBES];
+
+/* Fraction of its distance a reel has covered at each point of its spin, in
+Q16. Built once from the configured curve; the back-out curve goes past 1.0
+before settling. */
+static int32_t ease[REEL_EASE_STEPS + 1];
+static bool ease_ready = false;
+
+static uint32_t prng_state = 1;
+
+// Per-frame cost of the last run
+static uint32_t step_frames = 0;
+static uint32_t step_cycles_sum = 0;
+static uint32_t step_cycles_max = 0;
+static uint32_t hw_rng_cycles = 0;
+
+/* xorshift32: seeded once per run from the hardware RNG, which is far too
+slow to call for every digit of every frame. */
+static uint32_t xorshift32(void) {
+    uint32_t x = prng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return prng_state = x;
+}
+
+static float curve(float x) {
+    float u = 1.0f - x;
+#if CONFIG_REEL_EASE_QUINT
+    return 1.0f - u * u * u * u * u;
+#elif CONFIG_REEL_EASE_BACK
+    const float c1 = 1.70158f;
+    return 1.0f - (c1 + 1.0f) * u * u * u + c1 * u * u;
+#else
+    return 1.0f - u * u * u;
+#endif
+}
+
+static void build_ease_table(void) {
+    for (int i = 0; i <= REEL_EASE_STEPS; i++) {
+        ease[i] = (int32_t)(curve((float)i / REEL_EASE_STEPS) * 65536.0f);
+    }
+
+    // What the old effect paid per frame: one hardware RNG call per tube
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        (void)esp_random();
+    }
+    hw_rng_cycles = esp_cpu_get_cycle_count() - start;
+    ease_ready = true;
+}
+
+uint32_t reel_land_ms(int tube) {
+    return CONFIG_REEL_DURATION_MS + tube * CONFIG_REEL_STAGGER_MS;
+}
+
+/* Digits each tube settles on, normally the time at reel_land_ms() of that
+tube. Set before starting the effect. */
+void reel_set_targets(const uint8_t digits[DISPLAY_TUBES]) {
+    memcpy(targets, digits, sizeof(targets));
+}
+
+static void reel_start(void) {
+    if (!ease_ready) build_ease_table();
+    prng_state = esp_random() | 1;
+
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        reel_t* r = &reels[t];
+        uint32_t land_ms = reel_land_ms(t);
+        // Roughly a lap per second of spin, so every reel starts out fast
+        uint32_t laps = 1 + land_ms / 1000 + xorshift32() % 2;
+
+        r->start = xorshift32() % 10;
+        r->distance = laps * 10 + (targets[t] + 10 - r->start) % 10;
+        r->land_frame = land_ms / REEL_FRAME_MS;
+    }
+
+    step_frames = 0;
+    step_cycles_sum = 0;
+    step_cycles_max = 0;
+}
+
+static bool reel_step(uint32_t frame, anim_cel_t* cel) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint8_t digits[DISPLAY_TUBES];
+    uint64_t cover = 0;
+
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        const reel_t* r = &reels[t];
+        if (frame >= r->land_frame) {
+            digits[t] = DISPLAY_BLANK;
+            continue;
+        }
+        uint32_t i = frame * REEL_EASE_STEPS / r->land_frame;
+        // Rounded, so the reel comes to rest on the target before landing
+        int32_t pos =
+            (int32_t)(((int64_t)r->distance * ease[i] + (1 << 15)) >> 16);
+        digits[t] = (r->start + pos) % 10;
+        cover |= display_tube_cover[t];
+    }
+
+    if (cover == 0) {
+        if (step_frames > 0) {
+            ESP_LOGI(TAG,
+                     "%u frames, %u cycles/frame avg, %u max (%u cycles for "
+                     "%d hardware RNG calls)",
+                     (unsigned int)step_frames,
+                     (unsigned int)(step_cycles_sum / step_frames),
+                     (unsigned int)step_cycles_max,
+                     (unsigned int)hw_rng_cycles, DISPLAY_TUBES);
+        }
+        return false;
+    }
+
+    cel->bits = display_compose(digits, 0);
+    cel->cover = cover;
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    step_frames++;
+    step_cycles_sum += cycles;
+    if (cycles > step_cycles_max) step_cycles_max = cycles;
+    return true;
+}
+
+const anim_effect_t reel_slot_fx = {.name = "slot machine",
+                                    .layer = ANIM_LAYER_TRANSITION,
+                                    .priority = 1,
+                                    .period_ms = REEL_FRAME_MS,
+                                    .start = reel_start,
+                                    .step = reel_step};
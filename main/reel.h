@@ -0,0 +1,16 @@
+#ifndef REEL_H
+#define REEL_H
+
+#include <stdint.h>
+
+#include "anim.h"
+#include "display.h"
+
+uint32_t reel_land_ms(int tube);
+void reel_set_targets(const uint8_t digits[DISPLAY_TUBES]);
+
+// Slot machine: every tube spins as a reel, decelerates and settles on its
+// target digit, left to right. A tube that has landed shows the time again.
+extern const anim_effect_t reel_slot_fx;
+
+#endif /* REEL_H */
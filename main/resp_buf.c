@@ -0,0 +1,40 @@
+#include "resp_buf.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+static void flush(resp_buf_t* out) {
+    if (out->len > 0 && out->err == ESP_OK) {
+        out->err = httpd_resp_send_chunk(out->req, out->buf, out->len);
+    }
+    out->len = 0;
+}
+
+void resp_buf_init(resp_buf_t* out, httpd_req_t* req) {
+    out->req = req;
+    out->err = ESP_OK;
+    out->len = 0;
+}
+
+/* Append one formatted line, sending the chunk first if it would not fit.
+A line longer than the whole buffer is dropped. */
+void resp_buf_printf(resp_buf_t* out, const char* fmt, ...) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(out->buf) - out->len;
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(out->buf + out->len, room, fmt, args);
+        va_end(args);
+        if (n >= 0 && (size_t)n < room) {
+            out->len += n;
+            return;
+        }
+        flush(out);
+    }
+}
+
+esp_err_t resp_buf_finish(resp_buf_t* out) {
+    flush(out);
+    if (out->err != ESP_OK) return out->err;
+    return httpd_resp_send_chunk(out->req, NULL, 0);
+}
@@ -0,0 +1,24 @@
+#ifndef RESP_BUF_H
+#define RESP_BUF_H
+
+#include <esp_http_server.h>
+
+#define RESP_BUF_SIZE 512
+
+/* Chunked response built from formatted lines. Lines are gathered in the
+buffer, which lives on the handler's stack, and sent a chunk at a time, so
+long generated responses need no heap. After a send error, further output
+is dropped and resp_buf_finish() returns the error. */
+typedef struct {
+    httpd_req_t* req;
+    esp_err_t err;
+    size_t len;
+    char buf[RESP_BUF_SIZE];
+} resp_buf_t;
+
+void resp_buf_init(resp_buf_t* out, httpd_req_t* req);
+void resp_buf_printf(resp_buf_t* out, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+esp_err_t resp_buf_finish(resp_buf_t* out);
+
+#endif /* RESP_BUF_H */
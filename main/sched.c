@@ -0,0 +1,323 @@
+#include "sched.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <sys/time.h>
+
+#include "static_alloc.h"
+
+#define SCHED_TICK_US 10000
+/* Hierarchical wheel: level 0 holds the next 64 ticks one per slot, each
+level above covers 64 times the span of the one below, and its slots are
+cascaded down as the lower level wraps. Four levels reach 46 hours; jobs
+further out wait in the top level and are placed again on the way. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define SCHED_STACK_SIZE 3072
+#define SCHED_PRIORITY 3
+
+static const char* TAG = "sched";
+
+static SemaphoreHandle_t lock = NULL;
+static TaskHandle_t task = NULL;
+
+static sched_job_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t occupied[WHEEL_LEVELS];  // Bit per non-empty slot
+static uint64_t now_tick = 0;            // Ticks processed so far
+static sched_job_t* due = NULL;          // Expired, waiting to run
+static sched_job_t* wall_jobs = NULL;
+
+static uint64_t ticks_after(int64_t us) {
+    if (us < 0) us = 0;
+    return (esp_timer_get_time() + us + SCHED_TICK_US - 1) / SCHED_TICK_US;
+}
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void push(sched_job_t** head, sched_job_t* job) {
+    job->next = *head;
+    if (*head != NULL) (*head)->pprev = &job->next;
+    *head = job;
+    job->pprev = head;
+}
+
+static void unlink_job(sched_job_t* job) {
+    if (job->pprev == NULL) return;
+    *job->pprev = job->next;
+    if (job->next != NULL) job->next->pprev = job->pprev;
+    if (job->bucket >= 0 && (&wheel[0][0])[job->bucket] == NULL) {
+        occupied[job->bucket / WHEEL_SIZE] &=
+            ~(1ULL << (job->bucket % WHEEL_SIZE));
+    }
+    job->next = NULL;
+    job->pprev = NULL;
+    job->bucket = -1;
+}
+
+static void insert(sched_job_t* job) {
+    if (job->expires <= now_tick) {
+        job->bucket = -1;
+        push(&due, job);
+        return;
+    }
+
+    uint64_t delta = job->expires - now_tick;
+    uint64_t place = job->expires;
+    if (delta >= WHEEL_SPAN) {
+        // Parked in the top level; the cascade there places it again
+        delta = WHEEL_SPAN - 1;
+        place = now_tick + delta;
+    }
+    int level = 0;
+    while (delta >= (1ULL << (WHEEL_BITS * (level + 1)))) level++;
+    int slot = (place >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    job->bucket = level * WHEEL_SIZE + slot;
+    push(&wheel[level][slot], job);
+    occupied[level] |= 1ULL << slot;
+}
+
+/* Move the jobs of the level's slot for tick `t` down the wheel. Levels above
+go first, so their jobs can land in the slot being emptied here. */
+static void cascade(int level, uint64_t t) {
+    int slot = (t >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    if (slot == 0 && level + 1 < WHEEL_LEVELS) cascade(level + 1, t);
+
+    sched_job_t* job = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    occupied[level] &= ~(1ULL << slot);
+    while (job != NULL) {
+        sched_job_t* next = job->next;
+        job->pprev = NULL;
+        insert(job);
+        job = next;
+    }
+}
+
+/* Process every tick up to `target`, skipping stretches where nothing can
+happen: with the lowest levels empty, only the next cascade matters. */
+static void advance(uint64_t target) {
+    while (now_tick < target) {
+        int level = 0;
+        while (level < WHEEL_LEVELS && occupied[level] == 0) level++;
+        if (level == WHEEL_LEVELS) {
+            now_tick = target;
+            break;
+        }
+
+        uint64_t step = 1ULL << (WHEEL_BITS * level);
+        uint64_t t = (now_tick + step) & ~(step - 1);
+        if (t > target) {
+            now_tick = target;
+            break;
+        }
+        now_tick = t;
+        if ((t & WHEEL_MASK) == 0) cascade(1, t);
+
+        int slot = t & WHEEL_MASK;
+        sched_job_t* job = wheel[0][slot];
+        wheel[0][slot] = NULL;
+        occupied[0] &= ~(1ULL << slot);
+        while (job != NULL) {
+            sched_job_t* next = job->next;
+            job->bucket = -1;
+            push(&due, job);
+            job = next;
+        }
+    }
+}
+
+/* Tick at which the task has to look at the wheel again. */
+static uint64_t next_wake(void) {
+    if (due != NULL) return now_tick;
+
+    uint64_t wake = UINT64_MAX;
+    if (occupied[0] != 0) {
+        for (int d = 1; d <= WHEEL_SIZE; d++) {
+            if (occupied[0] & (1ULL << ((now_tick + d) & WHEEL_MASK))) {
+                wake = now_tick + d;
+                break;
+            }
+        }
+    }
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (occupied[level] != 0) {
+            uint64_t step = 1ULL << (WHEEL_BITS * level);
+            uint64_t t = (now_tick + step) & ~(step - 1);
+            if (t < wake) wake = t;
+            break;
+        }
+    }
+    return wake;
+}
+
+static void arm_wall(sched_job_t* job) {
+    job->expires = ticks_after((int64_t)job->at * 1000000 - wall_us());
+    insert(job);
+}
+
+/* Due job taken off the list: set up its next run, if it has one. Returns
+false if it must not run yet. */
+static bool rearm(sched_job_t* job) {
+    if (job->wall) {
+        int64_t now_us = wall_us();
+        // A slewed clock runs slower than the ticks, so re-check
+        if (now_us < (int64_t)job->at * 1000000 - SCHED_TICK_US / 2) {
+            arm_wall(job);
+            return false;
+        }
+        if (job->rule != NULL) {
+            // After a forward step, skip what was missed
+            time_t now = now_us / 1000000;
+            job->at = job->rule(now > job->at ? now : job->at);
+            arm_wall(job);
+        }
+    } else if (job->period != 0) {
+        // Fixed rate: late runs do not shift the ones after them
+        job->expires += job->period;
+        if (job->expires <= now_tick) job->expires = now_tick + job->period;
+        insert(job);
+    }
+    return true;
+}
+
+static void wake_task(void) {
+    if (task != NULL && xTaskGetCurrentTaskHandle() != task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+static void sched_task(void* pvParameters) {
+    while (1) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        advance(esp_timer_get_time() / SCHED_TICK_US);
+        while (due != NULL) {
+            sched_job_t* job = due;
+            unlink_job(job);
+            if (!rearm(job)) continue;
+
+            // Unlocked, so the job can re-arm or cancel jobs
+            sched_fn_t fn = job->fn;
+            void* arg = job->arg;
+            xSemaphoreGive(lock);
+            fn(arg);
+            xSemaphoreTake(lock, portMAX_DELAY);
+        }
+        uint64_t wake = next_wake();
+        xSemaphoreGive(lock);
+
+        TickType_t wait = portMAX_DELAY;
+        if (wake != UINT64_MAX) {
+            int64_t us = (int64_t)wake * SCHED_TICK_US - esp_timer_get_time();
+            if (us < 0) us = 0;
+            wait = (us + portTICK_PERIOD_MS * 1000 - 1) /
+                   (portTICK_PERIOD_MS * 1000);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+void sched_init(void) {
+    lock = MUTEX_CREATE();
+    now_tick = esp_timer_get_time() / SCHED_TICK_US;
+    TASK_CREATE(sched_task, "Sched", SCHED_STACK_SIZE, NULL, SCHED_PRIORITY,
+                &task);
+    ESP_LOGI(TAG, "Timer wheel up, %d ms ticks", SCHED_TICK_US / 1000);
+}
+
+/* Run `job` once, `ms` from now. Re-arming a job moves it. */
+void sched_after(sched_job_t* job, uint32_t ms) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unlink_job(job);
+    job->wall = false;
+    job->period = 0;
+    job->expires = ticks_after((int64_t)ms * 1000);
+    insert(job);
+    xSemaphoreGive(lock);
+    wake_task();
+}
+
+/* Run `job` every `period_ms`, the first time one period from now. */
+void sched_every(sched_job_t* job, uint32_t period_ms) {
+    uint32_t period = ((uint64_t)period_ms * 1000 + SCHED_TICK_US - 1) /
+                      SCHED_TICK_US;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unlink_job(job);
+    job->wall = false;
+    job->period = period > 0 ? period : 1;
+    job->expires = ticks_after((int64_t)job->period * SCHED_TICK_US);
+    insert(job);
+    xSemaphoreGive(lock);
+    wake_task();
+}
+
+static void set_wall(sched_job_t* job, time_t when, sched_rule_t rule) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unlink_job(job);
+    if (!job->listed) {
+        job->wall_next = wall_jobs;
+        wall_jobs = job;
+        job->listed = true;
+    }
+    job->wall = true;
+    job->period = 0;
+    job->rule = rule;
+    job->at = (rule != NULL) ? rule(wall_us() / 1000000) : when;
+    arm_wall(job);
+    xSemaphoreGive(lock);
+    wake_task();
+}
+
+/* Run `job` once when the wall clock reads `when`. */
+void sched_at(sched_job_t* job, time_t when) {
+    set_wall(job, when, NULL);
+}
+
+/* Run `job` at every wall-clock time `rule` yields, starting after now. The
+rule sees the clock's current time zone, so e.g. wallclock_next_hour makes
+a chime that stays on the hour across DST changes. */
+void sched_rule(sched_job_t* job, sched_rule_t rule) {
+    set_wall(job, 0, rule);
+}
+
+void sched_cancel(sched_job_t* job) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unlink_job(job);
+    xSemaphoreGive(lock);
+}
+
+bool sched_armed(const sched_job_t* job) {
+    return job->pprev != NULL;
+}
+
+/* The wall clock was stepped or the time zone changed: place the wall-clock
+jobs again, and ask the rules of repeating ones afresh. */
+void sched_time_changed(void) {
+    if (lock == NULL) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    time_t now = wall_us() / 1000000;
+    int n = 0;
+    for (sched_job_t* job = wall_jobs; job != NULL; job = job->wall_next) {
+        if (!job->wall || job->pprev == NULL) continue;
+        unlink_job(job);
+        if (job->rule != NULL) job->at = job->rule(now);
+        arm_wall(job);
+        n++;
+    }
+    xSemaphoreGive(lock);
+    wake_task();
+    if (n > 0) ESP_LOGI(TAG, "Time changed, %d wall-clock jobs moved", n);
+}
@@ -0,0 +1,43 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef void (*sched_fn_t)(void* arg);
+// Next wall-clock time strictly after `t`, e.g. wallclock_next_hour
+typedef time_t (*sched_rule_t)(time_t t);
+
+/* One job. Owned by the caller, usually static, and linked into the wheel
+while armed, so the scheduler never allocates. */
+typedef struct sched_job {
+    struct sched_job* next;
+    struct sched_job** pprev;  // NULL while not armed
+    int16_t bucket;            // Wheel slot it is in, or -1 while due
+    uint64_t expires;          // Scheduler ticks
+    uint32_t period;           // Ticks; 0 for one-shot jobs
+    bool wall;                 // Fires at `at`, a wall-clock time
+    time_t at;
+    sched_rule_t rule;  // Wall-clock jobs: what follows `at`, or NULL
+    struct sched_job* wall_next;  // All wall-clock jobs ever armed
+    bool listed;
+    sched_fn_t fn;
+    void* arg;
+} sched_job_t;
+
+#define SCHED_JOB_INIT(f, a) {.fn = (f), .arg = (a)}
+
+/* Timer-wheel scheduler. Jobs run one after another on the scheduler task,
+so they must be short and never block: post to a queue or notify a task for
+anything longer. A job may re-arm or cancel itself or any other job. */
+void sched_init(void);
+void sched_after(sched_job_t* job, uint32_t ms);
+void sched_every(sched_job_t* job, uint32_t period_ms);
+void sched_at(sched_job_t* job, time_t when);
+void sched_rule(sched_job_t* job, sched_rule_t rule);
+void sched_cancel(sched_job_t* job);
+bool sched_armed(const sched_job_t* job);
+void sched_time_changed(void);
+
+#endif /* SCHED_H */
@@ -0,0 +1,579 @@
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dither.h"
+#include "static_alloc.h"
+
+#define SETTINGS_NVS_NAMESPACE "settings"
+#define SETTINGS_NVS_KEY "record"
+#define SETTINGS_VERSION 1
+#define SETTINGS_MAX_SUBSCRIBERS 8
+#define SAVE_MAX_DELAY_PERIODS 10
+#define SAVE_STACK_SIZE 4096
+#define SAVE_PRIORITY 1
+#define BENCH_ROUNDS 10
+
+static const char* TAG = "settings";
+
+// The settings when nothing has been saved yet
+static const settings_t defaults = {
+    .ntp = "pool.ntp.org",
+    .clock = {.time_fmt = 1, .colon = 2, .fade_ms = 200},
+    .dimmer = {.day = 100, .night = 25, .night_from = 22, .night_to = 6},
+    .tube_bri = {100, 100, 100, 100, 100, 100},
+    .tz = {.city = "Los Angeles", .spec = "PST8PDT,M3.2.0,M11.1.0"},
+    .led = {.mode = "static"}};
+
+/* The stored form of the settings: settings_t as it is, tagged with its
+version and size. A change to settings_t bumps SETTINGS_VERSION, and
+load_nvs learns to convert the older records it then meets. */
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    settings_t settings;
+} settings_record_t;
+
+static settings_t current;
+static SemaphoreHandle_t lock = NULL;
+
+static SemaphoreHandle_t save_lock = NULL;
+static TaskHandle_t save_task_handle = NULL;
+static bool save_pending = false;
+static settings_stats_t stats;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct {
+    uint32_t mask;
+    settings_fn_t fn;
+} subscribers[SETTINGS_MAX_SUBSCRIBERS];
+static int subscriber_count = 0;
+
+static int clamp(int v, int lo, int hi) {
+    return (v < lo) ? lo : (v > hi) ? hi : v;
+}
+
+static void add_int(cJSON* obj, const char* key, int v) {
+    char text[12];
+    snprintf(text, sizeof(text), "%d", v);
+    cJSON_AddStringToObject(obj, key, text);
+}
+
+typedef enum { FIELD_STR, FIELD_INT, FIELD_LEVELS } field_kind_t;
+
+typedef struct {
+    const char* parent;  // Enclosing object, NULL at the top level
+    const char* key;
+    uint8_t kind;
+    uint8_t size;  // Of the member
+    uint16_t offset;
+    uint16_t max;  // Of a FIELD_INT, whose least is 0
+} field_t;
+
+#define FIELD(parent, key, kind, member, max)                     \
+    {parent, key, kind, sizeof(((settings_t*)0)->member),         \
+     offsetof(settings_t, member), max}
+
+/* Where each key of the JSON layout, that of /update bodies, /data and the
+old config.json, goes in settings_t.
+The web UI and older files give most integers as numeric strings. */
+static const field_t schema[] = {
+    FIELD(NULL, "ssid", FIELD_STR, wifi.ssid, 0),
+    FIELD(NULL, "pass", FIELD_STR, wifi.pass, 0),
+    FIELD(NULL, "ntp", FIELD_STR, ntp, 0),
+    FIELD(NULL, "time_fmt", FIELD_INT, clock.time_fmt, 1),
+    FIELD("time", "time_fmt", FIELD_INT, clock.time_fmt, 1),
+    FIELD(NULL, "colon", FIELD_INT, clock.colon, 2),
+    FIELD(NULL, "fade", FIELD_INT, clock.fade_ms, UINT16_MAX),
+    FIELD(NULL, "bri", FIELD_INT, dimmer.day, 100),
+    FIELD(NULL, "night_bri", FIELD_INT, dimmer.night, 100),
+    FIELD(NULL, "night_from", FIELD_INT, dimmer.night_from, 23),
+    FIELD(NULL, "night_to", FIELD_INT, dimmer.night_to, 23),
+    FIELD(NULL, "tube_bri", FIELD_LEVELS, tube_bri, 0),
+    FIELD("time", "city", FIELD_STR, tz.city, 0),
+    FIELD("time", "timezone", FIELD_STR, tz.spec, 0),
+    FIELD(NULL, "led_mode", FIELD_STR, led.mode, 0),
+    FIELD("color", "r", FIELD_INT, led.r, 255),
+    FIELD("color", "g", FIELD_INT, led.g, 255),
+    FIELD("color", "b", FIELD_INT, led.b, 255),
+};
+
+static void decode_field(settings_t* s, const field_t* f,
+                         json_stream_type_t type, const char* value) {
+    uint8_t* member = (uint8_t*)s + f->offset;
+    switch (f->kind) {
+        case FIELD_STR:
+            if (type != JSON_STREAM_STRING) return;
+            // Pads with zeros, so the groups compare equal byte for byte
+            strncpy((char*)member, value, f->size - 1);
+            member[f->size - 1] = '\0';
+            break;
+        case FIELD_INT: {
+            int v;
+            if (type == JSON_STREAM_NUMBER) {
+                v = (int)strtod(value, NULL);
+            } else if (type == JSON_STREAM_STRING && value[0] != '\0') {
+                v = atoi(value);
+            } else {
+                return;
+            }
+            v = clamp(v, 0, f->max);
+            if (f->size == 1) {
+                *member = v;
+            } else {
+                uint16_t v16 = v;
+                memcpy(member, &v16, sizeof(v16));
+            }
+            break;
+        }
+        case FIELD_LEVELS:
+            if (type == JSON_STREAM_STRING) {
+                dither_parse_levels(value, member);
+            }
+            break;
+    }
+}
+
+static void decode_value(void* ctx, const char* const* path, int depth,
+                         json_stream_type_t type, const char* value) {
+    if (depth < 1 || depth > 2) return;
+    const char* parent = depth == 2 ? path[0] : NULL;
+    const char* key = path[depth - 1];
+
+    for (int i = 0; i < sizeof(schema) / sizeof(schema[0]); i++) {
+        const field_t* f = &schema[i];
+        if (strcmp(f->key, key) != 0) continue;
+        if ((f->parent == NULL) != (parent == NULL)) continue;
+        if (parent != NULL && strcmp(f->parent, parent) != 0) continue;
+        decode_field(ctx, f, type, value);
+        return;
+    }
+}
+
+/* Set `js` up to decode a document in the JSON layout into `s`, as it is
+fed. The settings it has overwrite those in `s`; the rest keep their
+value, and unknown keys are skipped. */
+void settings_decoder_init(json_stream_t* js, settings_t* s) {
+    json_stream_init(js, decode_value, s);
+}
+
+/* The settings in the JSON layout, rendered for /data. */
+cJSON* settings_to_json(const settings_t* s) {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "ssid", s->wifi.ssid);
+    cJSON_AddStringToObject(json, "pass", s->wifi.pass);
+    cJSON_AddStringToObject(json, "ntp", s->ntp);
+    add_int(json, "colon", s->clock.colon);
+    add_int(json, "bri", s->dimmer.day);
+    add_int(json, "night_bri", s->dimmer.night);
+    add_int(json, "night_from", s->dimmer.night_from);
+    add_int(json, "night_to", s->dimmer.night_to);
+    add_int(json, "fade", s->clock.fade_ms);
+
+    char levels[DISPLAY_TUBES * 4];
+    int len = 0;
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        len += snprintf(levels + len, sizeof(levels) - len, "%s%d",
+                        t == 0 ? "" : ",", s->tube_bri[t]);
+    }
+    cJSON_AddStringToObject(json, "tube_bri", levels);
+
+    cJSON* time = cJSON_AddObjectToObject(json, "time");
+    cJSON_AddStringToObject(time, "city", s->tz.city);
+    cJSON_AddStringToObject(time, "timezone", s->tz.spec);
+    add_int(time, "time_fmt", s->clock.time_fmt);
+
+    cJSON_AddStringToObject(json, "led_mode", s->led.mode);
+    cJSON* color = cJSON_AddObjectToObject(json, "color");
+    cJSON_AddNumberToObject(color, "r", s->led.r);
+    cJSON_AddNumberToObject(color, "g", s->led.g);
+    cJSON_AddNumberToObject(color, "b", s->led.b);
+    return json;
+}
+
+static uint32_t differences(const settings_t* a, const settings_t* b) {
+    uint32_t changed = 0;
+    if (memcmp(&a->wifi, &b->wifi, sizeof(a->wifi)) != 0) {
+        changed |= SETTINGS_WIFI;
+    }
+    if (strcmp(a->ntp, b->ntp) != 0) changed |= SETTINGS_NTP;
+    if (memcmp(&a->clock, &b->clock, sizeof(a->clock)) != 0) {
+        changed |= SETTINGS_CLOCK;
+    }
+    if (memcmp(&a->dimmer, &b->dimmer, sizeof(a->dimmer)) != 0) {
+        changed |= SETTINGS_DIMMER;
+    }
+    if (memcmp(a->tube_bri, b->tube_bri, sizeof(a->tube_bri)) != 0) {
+        changed |= SETTINGS_TUBES;
+    }
+    if (memcmp(&a->tz, &b->tz, sizeof(a->tz)) != 0) changed |= SETTINGS_TZ;
+    if (memcmp(&a->led, &b->led, sizeof(a->led)) != 0) {
+        changed |= SETTINGS_LED;
+    }
+    return changed;
+}
+
+static void notify(const settings_t* s, uint32_t changed) {
+    for (int i = 0; i < subscriber_count; i++) {
+        if (subscribers[i].mask & changed) {
+            subscribers[i].fn(s, changed);
+        }
+    }
+}
+
+void settings_get(settings_t* out) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = current;
+    xSemaphoreGive(lock);
+}
+
+/* Replace the settings, then call the subscribers of the groups that
+changed. Returns those groups. */
+uint32_t settings_update(const settings_t* next) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t changed = differences(&current, next);
+    current = *next;
+    xSemaphoreGive(lock);
+
+    notify(next, changed);
+    return changed;
+}
+
+/* Call `fn` whenever a group in `mask` changes. For the modules' init, all
+before the web server starts, so the table needs no lock. */
+void settings_subscribe(uint32_t mask, settings_fn_t fn) {
+    if (subscriber_count == SETTINGS_MAX_SUBSCRIBERS) {
+        ESP_LOGE(TAG, "Too many subscribers");
+        return;
+    }
+    subscribers[subscriber_count].mask = mask;
+    subscribers[subscriber_count].fn = fn;
+    subscriber_count++;
+}
+
+/* Call the subscribers of `mask` with the stored settings, e.g. to undo a
+live preview that went around the store. */
+void settings_refresh(uint32_t mask) {
+    settings_t s;
+    settings_get(&s);
+    notify(&s, mask);
+}
+
+/* Read the record into `s`. False if there is none of this version, e.g.
+before the migration from config.json. */
+static bool load_nvs(settings_t* s) {
+    nvs_handle_t handle;
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    static settings_record_t r;
+    size_t size = sizeof(r);
+    esp_err_t ret = nvs_get_blob(handle, SETTINGS_NVS_KEY, &r, &size);
+    nvs_close(handle);
+
+    if (ret != ESP_OK || size != sizeof(r) || r.version != SETTINGS_VERSION ||
+        r.size != sizeof(settings_t)) {
+        return false;
+    }
+    *s = r.settings;
+    // Whatever the flash held, the strings end inside their members
+    for (int i = 0; i < sizeof(schema) / sizeof(schema[0]); i++) {
+        if (schema[i].kind == FIELD_STR) {
+            ((char*)s)[schema[i].offset + schema[i].size - 1] = '\0';
+        }
+    }
+    return true;
+}
+
+// Kept open between saves, as every nvs_open allocates
+static nvs_handle_t save_handle = 0;
+
+static esp_err_t store_nvs(const settings_t* s) {
+    static settings_record_t r;
+    r.version = SETTINGS_VERSION;
+    r.size = sizeof(settings_t);
+    r.settings = *s;
+
+    esp_err_t ret = ESP_OK;
+    if (save_handle == 0) {
+        ret = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &save_handle);
+        if (ret != ESP_OK) save_handle = 0;
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(save_handle, SETTINGS_NVS_KEY, &r, sizeof(r));
+    }
+    if (ret == ESP_OK) ret = nvs_commit(save_handle);
+    return ret;
+}
+
+static esp_err_t write_settings(void) {
+    settings_t s;
+    settings_get(&s);
+    esp_err_t ret = store_nvs(&s);
+
+    portENTER_CRITICAL(&stats_mux);
+    if (ret == ESP_OK) {
+        stats.writes++;
+        stats.bytes += sizeof(settings_record_t);
+    } else {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save settings (%s)", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+/* Write the settings if a save is pending. The flag is cleared before the
+snapshot is taken, so a change made meanwhile gets a write of its own. */
+esp_err_t settings_flush(void) {
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(save_lock, portMAX_DELAY);
+    if (__atomic_exchange_n(&save_pending, false, __ATOMIC_ACQ_REL)) {
+        ret = write_settings();
+    }
+    xSemaphoreGive(save_lock);
+    return ret;
+}
+
+/* Waits for a save request, then for CONFIG_SETTINGS_SAVE_DELAY_MS without
+another one, so a burst of changes costs one flash write. A steady stream
+of changes is still written every SAVE_MAX_DELAY_PERIODS periods. */
+static void save_task(void* pvParameters) {
+    const TickType_t quiet = pdMS_TO_TICKS(CONFIG_SETTINGS_SAVE_DELAY_MS);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        TickType_t start = xTaskGetTickCount();
+        while (xTaskGetTickCount() - start < quiet * SAVE_MAX_DELAY_PERIODS &&
+               ulTaskNotifyTake(pdTRUE, quiet) > 0) {
+        }
+        settings_flush();
+    }
+}
+
+/* Have the settings written to NVS after the quiet period. Returns
+at once; settings_flush writes a pending save right away. */
+void settings_save(void) {
+    __atomic_store_n(&save_pending, true, __ATOMIC_RELEASE);
+    portENTER_CRITICAL(&stats_mux);
+    stats.requests++;
+    portEXIT_CRITICAL(&stats_mux);
+    xTaskNotifyGive(save_task_handle);
+}
+
+void settings_get_stats(settings_stats_t* out) {
+    portENTER_CRITICAL(&stats_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+/* Bring the settings in from config.json, as earlier firmware kept them,
+or start from the defaults, and store them in NVS. The file is kept as
+CONFIG_OLD_FILENAME once migrated. */
+static void migrate(void) {
+    // Decoded into a copy, so a damaged file leaves all of the defaults
+    static settings_t loaded;
+    loaded = defaults;
+    json_stream_t js;
+    settings_decoder_init(&js, &loaded);
+
+    esp_err_t ret = read_json_stream(&js);
+    if (ret == ESP_OK) {
+        current = loaded;
+    } else if (ret != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "%s is not valid JSON near byte %u, using the defaults",
+                 CONFIG_FILENAME, (unsigned int)js.pos);
+    }
+
+    settings_save();
+    if (settings_flush() != ESP_OK) return;
+    if (ret == ESP_OK) {
+        archive_json_data();
+        ESP_LOGI(TAG, "Moved the settings from %s to NVS", CONFIG_FILENAME);
+    } else {
+        ESP_LOGI(TAG, "Stored the default settings in NVS");
+    }
+}
+
+/* Load the settings from NVS once, migrating them there on the first boot.
+Runs after config_init and nvs_flash_init, and before any module reads its
+settings. */
+void settings_init(void) {
+    lock = MUTEX_CREATE();
+    save_lock = MUTEX_CREATE();
+    TASK_CREATE(save_task, "Config save", SAVE_STACK_SIZE, NULL, SAVE_PRIORITY,
+                &save_task_handle);
+    current = defaults;
+
+    int64_t start = esp_timer_get_time();
+    if (load_nvs(&current)) {
+        ESP_LOGI(TAG, "Loaded in %lld us", esp_timer_get_time() - start);
+    } else {
+        migrate();
+    }
+
+#if CONFIG_SETTINGS_BENCHMARK
+    settings_benchmark();
+#endif
+}
+
+#if CONFIG_SETTINGS_BENCHMARK
+/* Integer at `key`, given either as a number or as a numeric string, which
+is how the web UI and older files store most of them. */
+static bool get_int(const cJSON* obj, const char* key, int* out) {
+    const cJSON* item = cJSON_GetObjectItem(obj, key);
+    if (cJSON_IsNumber(item)) {
+        *out = item->valueint;
+        return true;
+    }
+    if (cJSON_IsString(item) && item->valuestring[0] != '\0') {
+        *out = atoi(item->valuestring);
+        return true;
+    }
+    return false;
+}
+
+static void get_str(const cJSON* obj, const char* key, char* out,
+                    size_t size) {
+    const cJSON* item = cJSON_GetObjectItem(obj, key);
+    if (cJSON_IsString(item)) {
+        // Pads with zeros, so the groups compare equal byte for byte
+        strncpy(out, item->valuestring, size - 1);
+        out[size - 1] = '\0';
+    }
+}
+
+/* What settings_decoder_init does, through a cJSON tree, as boot and
+/update once did. */
+static void decode_tree(const cJSON* json, settings_t* s) {
+    int v;
+
+    get_str(json, "ssid", s->wifi.ssid, sizeof(s->wifi.ssid));
+    get_str(json, "pass", s->wifi.pass, sizeof(s->wifi.pass));
+    get_str(json, "ntp", s->ntp, sizeof(s->ntp));
+
+    const cJSON* time = cJSON_GetObjectItem(json, "time");
+    if (get_int(json, "time_fmt", &v) || get_int(time, "time_fmt", &v)) {
+        s->clock.time_fmt = clamp(v, 0, 1);
+    }
+    if (get_int(json, "colon", &v)) s->clock.colon = clamp(v, 0, 2);
+    if (get_int(json, "fade", &v)) s->clock.fade_ms = clamp(v, 0, UINT16_MAX);
+
+    if (get_int(json, "bri", &v)) s->dimmer.day = clamp(v, 0, 100);
+    if (get_int(json, "night_bri", &v)) s->dimmer.night = clamp(v, 0, 100);
+    if (get_int(json, "night_from", &v)) {
+        s->dimmer.night_from = clamp(v, 0, 23);
+    }
+    if (get_int(json, "night_to", &v)) s->dimmer.night_to = clamp(v, 0, 23);
+
+    const cJSON* tube_bri = cJSON_GetObjectItem(json, "tube_bri");
+    if (cJSON_IsString(tube_bri)) {
+        dither_parse_levels(tube_bri->valuestring, s->tube_bri);
+    }
+
+    get_str(time, "city", s->tz.city, sizeof(s->tz.city));
+    get_str(time, "timezone", s->tz.spec, sizeof(s->tz.spec));
+
+    get_str(json, "led_mode", s->led.mode, sizeof(s->led.mode));
+    const cJSON* color = cJSON_GetObjectItem(json, "color");
+    if (get_int(color, "r", &v)) s->led.r = clamp(v, 0, 255);
+    if (get_int(color, "g", &v)) s->led.g = clamp(v, 0, 255);
+    if (get_int(color, "b", &v)) s->led.b = clamp(v, 0, 255);
+}
+
+
+static uint32_t tree_allocs = 0;
+static size_t tree_bytes = 0;
+
+static void* counting_malloc(size_t size) {
+    tree_allocs++;
+    tree_bytes += size;
+    return malloc(size);
+}
+
+/* Compare the SPIFFS and JSON path of earlier firmware with NVS, both for
+loading, where config.json is decoded through a cJSON tree, counting its
+allocations, and streamed, and for the write after a change. Each write
+flips a bit, since NVS skips writes of equal data. The config.json the
+benchmark writes is removed again. */
+void settings_benchmark(void) {
+    static settings_t s;
+    settings_get(&s);
+
+    int64_t t0 = esp_timer_get_time();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        s.clock.fade_ms ^= 1;
+        cJSON* json = settings_to_json(&s);
+        char* text = cJSON_Print(json);
+        cJSON_Delete(json);
+        if (text == NULL) return;
+        write_json_data(text);
+        cJSON_free(text);
+    }
+
+    cJSON_Hooks hooks = {.malloc_fn = counting_malloc, .free_fn = free};
+    cJSON_InitHooks(&hooks);
+    int64_t t1 = esp_timer_get_time();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        s = defaults;
+        char* data = read_json_data();
+        if (data == NULL) break;
+        cJSON* json = cJSON_Parse(data);
+        release_json_data(data);
+        decode_tree(json, &s);
+        cJSON_Delete(json);
+    }
+    int64_t t2 = esp_timer_get_time();
+    // Boot runs this before json_arena_init, so the default hooks are right
+    cJSON_InitHooks(NULL);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        s = defaults;
+        json_stream_t js;
+        settings_decoder_init(&js, &s);
+        if (read_json_stream(&js) != ESP_OK) break;
+    }
+    int64_t t3 = esp_timer_get_time();
+    unlink(CONFIG_FILENAME);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        s.clock.fade_ms ^= 1;
+        store_nvs(&s);
+    }
+    int64_t t4 = esp_timer_get_time();
+    for (int round = 0; round < BENCH_ROUNDS; round++) load_nvs(&s);
+    int64_t t5 = esp_timer_get_time();
+
+    // Put back the stored settings
+    settings_get(&s);
+    store_nvs(&s);
+
+    ESP_LOGI(TAG,
+             "Settings load: %lld us from %s through cJSON, with %u "
+             "allocations of %u bytes, %lld us streamed, %lld us from NVS",
+             (t2 - t1) / BENCH_ROUNDS, CONFIG_FILENAME,
+             (unsigned int)(tree_allocs / BENCH_ROUNDS),
+             (unsigned int)(tree_bytes / BENCH_ROUNDS),
+             (t3 - t2) / BENCH_ROUNDS, (t5 - t4) / BENCH_ROUNDS);
+    ESP_LOGI(TAG, "Settings write: %lld us to %s, %lld us to NVS",
+             (t1 - t0) / BENCH_ROUNDS, CONFIG_FILENAME,
+             (t4 - t3) / BENCH_ROUNDS);
+}
+
+#else
+
+void settings_benchmark(void) {}
+
+#endif
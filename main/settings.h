@@ -0,0 +1,74 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <cJSON.h>
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "dimmer.h"
+#include "display.h"
+#include "json_stream.h"
+#include "sntp.h"
+#include "tz.h"
+
+// Groups of settings, as masks of what changed and what a subscriber wants
+#define SETTINGS_WIFI (1u << 0)
+#define SETTINGS_NTP (1u << 1)
+#define SETTINGS_CLOCK (1u << 2)
+#define SETTINGS_DIMMER (1u << 3)
+#define SETTINGS_TUBES (1u << 4)
+#define SETTINGS_TZ (1u << 5)
+#define SETTINGS_LED (1u << 6)
+#define SETTINGS_ALL 0x7fu
+
+typedef struct {
+    struct {
+        char ssid[33];
+        char pass[65];
+    } wifi;
+    char ntp[SNTP_SERVER_LIST_LEN];  // Empty for CONFIG_SNTP_TIME_SERVER
+    struct {
+        uint8_t time_fmt;  // 0: 12h, 1: 24h
+        uint8_t colon;     // 0: Off, 1: On, 2: Blinking
+        uint16_t fade_ms;  // Digit crossfade, 0: hard switch
+    } clock;
+    dimmer_schedule_t dimmer;
+    uint8_t tube_bri[DISPLAY_TUBES];  // Percent, left to right
+    struct {
+        char city[32];
+        char spec[TZ_SPEC_LEN];  // POSIX TZ rules
+    } tz;
+    struct {
+        char mode[16];
+        uint8_t r, g, b;
+    } led;
+} settings_t;
+
+typedef struct {
+    uint32_t requests;  // settings_save calls
+    uint32_t writes;    // To NVS, after coalescing
+    uint32_t failures;
+    uint64_t bytes;  // Written by those writes
+} settings_stats_t;
+
+// Called with the new settings and the SETTINGS_* groups that changed
+typedef void (*settings_fn_t)(const settings_t* s, uint32_t changed);
+
+/* The settings, kept in RAM and stored in NVS as a versioned binary record
+that the first boot migrates config.json into; JSON is only their form on
+the wire. Reading them never touches flash; modules subscribe to the groups
+they use and are called, in the updater's task, whenever one of those
+changes. Saves go to NVS from a task of their own, coalesced. */
+void settings_init(void);
+void settings_get(settings_t* out);
+uint32_t settings_update(const settings_t* next);
+void settings_subscribe(uint32_t mask, settings_fn_t fn);
+void settings_refresh(uint32_t mask);
+void settings_decoder_init(json_stream_t* js, settings_t* s);
+cJSON* settings_to_json(const settings_t* s);
+void settings_save(void);
+esp_err_t settings_flush(void);
+void settings_get_stats(settings_stats_t* out);
+void settings_benchmark(void);
+
+#endif /* SETTINGS_H */
@@ -55,7 +55,21 @@ async function fetchData() {
 }
 
 function updateForm(data) {
-  const fields = ["ssid", "pass", "colon", "ntp", "time", "color", "led_mode"];
+  const fields = [
+    "ssid",
+    "pass",
+    "colon",
+    "ntp",
+    "time",
+    "color",
+    "led_mode",
+    "bri",
+    "night_bri",
+    "night_from",
+    "night_to",
+    "fade",
+    "tube_bri",
+  ];
 
   fields.forEach((field) => {
     if (field === "time") {
@@ -94,6 +108,16 @@ async function sendModeUpdate(mode) {
   }
 }
 
+async function sendChrono(cmd) {
+  const secs = document.getElementById("chrono_secs").value;
+  try {
+    await fetch(`/chrono?cmd=${cmd}&secs=${secs}`);
+    console.log(`Chrono command sent: ${cmd}`);
+  } catch (error) {
+    console.error("Error sending chrono command:", error);
+  }
+}
+
 async function updateValues(event) {
   event.preventDefault();
 
@@ -112,6 +136,12 @@ async function updateValues(event) {
     time_fmt: data.time_fmt,
     ntp: data.ntp,
     colon: data.colon,
+    bri: data.bri,
+    night_bri: data.night_bri,
+    night_from: data.night_from,
+    night_to: data.night_to,
+    fade: data.fade,
+    tube_bri: data.tube_bri,
     led_mode: data.led_mode,
     color: {
       r: Math.round(currentRGB.r),
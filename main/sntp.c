@@ -1,125 +1,341 @@
 #include "sntp.h"
 
-#include <cJSON.h>
-#include <esp_event.h>
 #include <esp_log.h>
-#include <esp_netif_sntp.h>
-#include <esp_sntp.h>
-#include <esp_system.h>
-#include <protocol_examples_common.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
-#include "config.h"
+#include "discipline.h"
+#include "ntp_client.h"
+#include "sched.h"
+#include "settings.h"
+#include "static_alloc.h"
+#include "timekeep.h"
+#include "tz.h"
+#include "wallclock.h"
+
+// The frequency correction is applied in steps of this length
+#define DISC_TICK_S 16
+// Retry interval while no server answers
+#define NTP_RETRY_S DISC_TICK_S
+// A server passed over this many polls is probed anyway, so one that
+// recovers from an outage gets picked again
+#define NTP_PROBE_IDLE_POLLS 8
 
 static const char* TAG = "sntp";
 
-void time_sync_notification_cb(struct timeval* tv) {
-    ESP_LOGI(TAG, "Notification of a time synchronization event");
+static TaskHandle_t sntp_task_handle = NULL;
+
+// Owned by the SNTP task; fields read by sntp_get_stats() change under
+// disc_mux
+static ntp_server_t servers[SNTP_MAX_SERVERS];
+static int server_count = 0;
+static int current_server = -1;
+
+// Server list from the config, waiting for the SNTP task to pick it up
+static char pending_list[SNTP_SERVER_LIST_LEN];
+static bool list_pending = false;
+
+static discipline_t disc;
+static portMUX_TYPE disc_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t last_sync_us = -1;  // esp_timer time of the last update
+static uint32_t polls = 0;
+static uint32_t failures = 0;
+static uint32_t steps = 0;
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
-static void obtain_time(void) {
-    ESP_LOGI(TAG, "Initializing and starting SNTP");
+static struct timeval us_to_timeval(int64_t us) {
+    // Both fields carry the sign, which is what adjtime() expects
+    struct timeval tv = {.tv_sec = us / 1000000, .tv_usec = us % 1000000};
+    return tv;
+}
 
-    // SNTP configuration
-    esp_sntp_config_t config =
-        ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_SNTP_TIME_SERVER);
-    config.sync_cb = time_sync_notification_cb;
+/* Split "a.example.org, b.example.org" into `out`. Returns the number of
+servers. */
+static int parse_servers(const char* list, ntp_server_t* out) {
+    int n = 0;
+    const char* p = list;
 
-    esp_netif_sntp_init(&config);
+    while (n < SNTP_MAX_SERVERS) {
+        p += strspn(p, ", \t");
+        size_t len = strcspn(p, ", \t");
+        if (len == 0) break;
+        if (len < SNTP_SERVER_NAME_LEN) {
+            out[n] = (ntp_server_t){0};
+            memcpy(out[n].name, p, len);
+            n++;
+        } else {
+            ESP_LOGW(TAG, "Server name too long, skipped: %.*s", (int)len, p);
+        }
+        p += len;
+    }
+    return n;
+}
 
-    // Wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = {0};
-    int retry = 0;
-    const int retry_count = 15;
-    while (esp_netif_sntp_sync_wait(2000 / portTICK_PERIOD_MS) ==
-               ESP_ERR_TIMEOUT &&
-           ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry,
-                 retry_count);
+/* Pick the server for the next poll: the best reach, least recently used
+among equals, except that one idle for NTP_PROBE_IDLE_POLLS gets probed. */
+static int pick_server(void) {
+    int best = -1;
+    for (int i = 0; i < server_count; i++) {
+        if (servers[i].idle >= NTP_PROBE_IDLE_POLLS) return i;
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        int health = __builtin_popcount(servers[i].reach);
+        int best_health = __builtin_popcount(servers[best].reach);
+        if (health > best_health ||
+            (health == best_health && servers[i].idle > servers[best].idle)) {
+            best = i;
+        }
     }
-    time(&now);
-    localtime_r(&now, &timeinfo);
+    return best;
+}
 
-    char strftime_buf[64];
-    // localtime_r(&now, &timeinfo);
-    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
-    ESP_LOGI(TAG, "(obtain_time) -The current date/time is: %s", strftime_buf);
+/* Record a poll of server `s` that returned `n` samples. Call under
+disc_mux. */
+static void score_server(int s, int n, int64_t delay_us) {
+    for (int i = 0; i < server_count; i++) {
+        if (servers[i].idle < UINT8_MAX) servers[i].idle++;
+    }
+    servers[s].idle = 0;
+    servers[s].reach = (servers[s].reach << 1) | (n > 0);
+    if (n > 0) {
+        servers[s].delay_us = delay_us;
+    } else {
+        // Pool names rotate addresses; try a fresh one next time
+        servers[s].resolved = false;
+    }
+    current_server = s;
 }
 
-void sync_sntp(void) {
-    time_t now;
-    struct tm timeinfo;
-    time(&now);
-    localtime_r(&now, &timeinfo);
+/* Take over a new server list from the config. */
+static void apply_pending_list(void) {
+    ntp_server_t parsed[SNTP_MAX_SERVERS];
+    char list[SNTP_SERVER_LIST_LEN];
 
-    if (timeinfo.tm_year < (2016 - 1900)) {
-        ESP_LOGI(TAG,
-                 "Time is not set yet. Connecting to WiFi and getting time "
-                 "over NTP.");
-        obtain_time();
-        time(&now);
+    portENTER_CRITICAL(&disc_mux);
+    strcpy(list, pending_list);
+    list_pending = false;
+    portEXIT_CRITICAL(&disc_mux);
+
+    int n = parse_servers(list, parsed);
+    if (n == 0) {
+        n = parse_servers(CONFIG_SNTP_TIME_SERVER, parsed);
     }
 
-    char timezone_str[32] = "";
-    FILE* file = fopen(CONFIG_FILENAME, "r");
-    if (file != NULL) {
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-
-        if (file_size <= 0) {
-            ESP_LOGE(TAG, "File is empty or error determining size");
-            fclose(file);
-            return;
-        }
+    portENTER_CRITICAL(&disc_mux);
+    memcpy(servers, parsed, sizeof(parsed));
+    server_count = n;
+    current_server = -1;
+    portEXIT_CRITICAL(&disc_mux);
 
-        char* buffer = (char*)malloc(file_size + 1);
-        if (buffer == NULL) {
-            ESP_LOGE(TAG, "Failed to allocate memory for file buffer");
-            fclose(file);
-            return;
-        }
+    ESP_LOGI(TAG, "%d NTP server(s): %s", n, list[0] ? list : "(default)");
+}
+
+/* Add the frequency correction due for the last `elapsed_us` to whatever
+adjtime() still has outstanding. */
+static void apply_frequency(int64_t elapsed_us) {
+    portENTER_CRITICAL(&disc_mux);
+    int64_t us = discipline_freq_correction(&disc, elapsed_us);
+    portEXIT_CRITICAL(&disc_mux);
+    if (us == 0) return;
+
+    struct timeval pending;
+    adjtime(NULL, &pending);
+    struct timeval delta =
+        us_to_timeval((int64_t)pending.tv_sec * 1000000 + pending.tv_usec + us);
+    adjtime(&delta, NULL);
+}
+
+/* One poll: all servers at once when `acquire` is set, otherwise a burst to
+the healthiest one; then the clock filter, then step or slew. Returns false
+if no server answered. */
+static bool ntp_poll(bool acquire) {
+    disc_sample_t samples[DISC_MAX_SAMPLES];
+    int s;
+    int n;
+
+    if (acquire) {
+        s = ntp_acquire(servers, server_count, &samples[0]);
+        n = (s >= 0) ? 1 : 0;
+    } else {
+        s = pick_server();
+        n = (s >= 0) ? ntp_burst(&servers[s], samples) : 0;
+    }
+    int64_t mono = esp_timer_get_time();
+
+    portENTER_CRITICAL(&disc_mux);
+    polls++;
+    if (n == 0) failures++;
+    disc_action_t action = discipline_update(&disc, samples, n, mono);
+    discipline_t d = disc;
+    if (s >= 0) score_server(s, n, d.delay_us);
+    if (action != DISC_IGNORE) last_sync_us = mono;
+    if (action == DISC_STEP) steps++;
+    portEXIT_CRITICAL(&disc_mux);
+
+    if (n == 0) {
+        ESP_LOGW(TAG, "No answer from %s",
+                 acquire || s < 0 ? "any server" : servers[s].name);
+        return false;
+    }
+
+    // Server time, taken once: after a step the clock already includes it
+    struct timeval now = us_to_timeval(wall_us() + d.offset_us);
 
-        fread(buffer, 1, file_size, file);
-        fclose(file);
-        buffer[file_size] = '\0';
+    if (action == DISC_STEP) {
+        // Drop any slew in progress: it was for the old time
+        struct timeval zero = {0};
+        adjtime(&zero, NULL);
+        settimeofday(&now, NULL);
+        wallclock_invalidate();
+        sched_time_changed();
+        ESP_LOGW(TAG, "Stepped the clock by %lld ms", d.offset_us / 1000);
+    } else if (action == DISC_SLEW) {
+        struct timeval delta = us_to_timeval(d.offset_us);
+        adjtime(&delta, NULL);
+    } else {
+        ESP_LOGW(TAG, "Ignored offset of %lld ms, waiting for confirmation",
+                 d.offset_us / 1000);
+        return true;
+    }
+
+    timekeep_synced(&now);
+    ESP_LOGI(TAG,
+             "%s: offset %+lld us, delay %lld us, jitter %lld us, "
+             "drift %+ld ppb, poll %d s (%d samples)",
+             servers[s].name, d.offset_us, d.delay_us, d.jitter_us,
+             (long)d.freq_ppb, 1 << d.poll, n);
+    return true;
+}
 
-        ESP_LOGI(TAG, "buffer: %s", buffer);
+/* Poll on the discipline's interval and spread the frequency correction
+over DISC_TICK_S steps in between. A new server list wakes the task and is
+acquired from at once. */
+static void sntp_task(void* pvParameters) {
+    int64_t last_tick = esp_timer_get_time();
+    int64_t next_poll = last_tick;
+    bool acquire = true;
 
-        cJSON* root = cJSON_Parse(buffer);
-        if (root == NULL) {
-            ESP_LOGE(TAG, "Failed to parse JSON");
-            free(buffer);
-            return;
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        apply_frequency(now - last_tick);
+        last_tick = now;
+
+        if (list_pending) {
+            apply_pending_list();
+            acquire = true;
+            next_poll = now;
         }
 
-        cJSON* time_json = cJSON_GetObjectItem(root, "time");
-        if (time_json != NULL && cJSON_IsObject(time_json)) {
-            cJSON* timezone_json = cJSON_GetObjectItem(time_json, "timezone");
-            if (timezone_json != NULL && cJSON_IsString(timezone_json)) {
-                strncpy(timezone_str, timezone_json->valuestring,
-                        sizeof(timezone_str) - 1);
-                timezone_str[sizeof(timezone_str) - 1] =
-                    '\0';  // Ensure null-termination
-            }
+        if (now >= next_poll) {
+            bool ok = ntp_poll(acquire);
+            acquire = acquire && !ok;
+            int interval_s = ok ? (1 << disc.poll) : NTP_RETRY_S;
+            next_poll = esp_timer_get_time() + interval_s * 1000000LL;
         }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DISC_TICK_S * 1000));
+    }
+}
 
-        cJSON_Delete(root);
-        free(buffer);
-    } else {
-        ESP_LOGE(TAG, "Failed to open config file");
+/* Use the servers in `list`, separated by commas or spaces; an empty list
+means CONFIG_SNTP_TIME_SERVER. Applied live by the SNTP task, and only if
+the list changed. */
+void sntp_set_servers(const char* list) {
+    bool changed = false;
+
+    portENTER_CRITICAL(&disc_mux);
+    if (strncmp(list, pending_list, sizeof(pending_list)) != 0) {
+        strncpy(pending_list, list, sizeof(pending_list) - 1);
+        pending_list[sizeof(pending_list) - 1] = '\0';
+        list_pending = true;
+        changed = true;
+    }
+    portEXIT_CRITICAL(&disc_mux);
+
+    if (changed && sntp_task_handle != NULL) {
+        xTaskNotifyGive(sntp_task_handle);
+    }
+}
+
+static void apply_servers(const settings_t* s, uint32_t changed) {
+    sntp_set_servers(s->ntp);
+}
+
+/* Take the servers from the `ntp` config key, now and whenever it changes.
+Like every subscription, made before the web server starts; changes until
+sync_sntp() wait in the pending list. */
+void sntp_init(void) {
+    // Subscribed first, so no change can slip in between
+    settings_subscribe(SETTINGS_NTP, apply_servers);
+    settings_t settings;
+    settings_get(&settings);
+    sntp_set_servers(settings.ntp);
+    list_pending = true;  // Even if the list is empty
+}
+
+/* Start disciplining the clock against the servers from sntp_init(). The
+time restored at boot is only an estimate, so this runs even when the
+clock already looks set. The network task calls it once Wi-Fi is up. */
+void sync_sntp(void) {
+    discipline_init(&disc, timekeep_drift_ppb(), CONFIG_NTP_MIN_POLL,
+                    CONFIG_NTP_MAX_POLL, CONFIG_NTP_STEP_THRESHOLD_MS * 1000LL);
+    TASK_CREATE(sntp_task, "SNTP", 4096, NULL, 3, &sntp_task_handle);
+}
+
+void sntp_get_stats(sntp_stats_t* stats) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&disc_mux);
+    stats->synced = disc.synced;
+    stats->offset_us = disc.offset_us;
+    stats->delay_us = disc.delay_us;
+    stats->jitter_us = disc.jitter_us;
+    stats->drift_ppb = disc.freq_ppb;
+    stats->poll_s = 1 << disc.poll;
+    stats->last_sync_age_s =
+        last_sync_us < 0 ? -1 : (now - last_sync_us) / 1000000;
+    stats->polls = polls;
+    stats->failures = failures;
+    stats->steps = steps;
+    stats->server_count = server_count;
+    stats->current_server = current_server;
+    for (int i = 0; i < server_count; i++) {
+        strcpy(stats->servers[i].name, servers[i].name);
+        stats->servers[i].reach = servers[i].reach;
+        stats->servers[i].delay_us = servers[i].delay_us;
     }
+    portEXIT_CRITICAL(&disc_mux);
+}
+
+static void apply_time_zone(const settings_t* s, uint32_t changed) {
+    ESP_LOGI(TAG, "tz_str: %s", s->tz.spec);
+    // The hourly chime and other wall-clock jobs follow the new zone
+    if (tz_set(s->tz.spec)) sched_time_changed();
+}
+
+/* Apply the time zone from the settings, now and whenever it changes. Needs
+no network, so it runs before the display starts. */
+void sntp_load_timezone(void) {
+    time_t now;
+    struct tm timeinfo;
+    time(&now);
 
-    char tz_str[32];
-    snprintf(tz_str, sizeof(tz_str), "%s", timezone_str);
-    ESP_LOGI(TAG, "tz_str: %s", tz_str);
-    setenv("TZ", tz_str, 1);
-    ESP_LOGI(TAG, "TZ environment variable set to: %s", getenv("TZ"));
-    tzset();
-    ESP_LOGI(TAG, "TZ environment variable set to (after tzset): %s",
-             getenv("TZ"));
+    settings_t settings;
+    settings_get(&settings);
+    apply_time_zone(&settings, SETTINGS_TZ);
+    settings_subscribe(SETTINGS_TZ, apply_time_zone);
 
     char strftime_buf[64];
     localtime_r(&now, &timeinfo);
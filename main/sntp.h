@@ -1,6 +1,39 @@
 #ifndef SNTP_H
 #define SNTP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SNTP_MAX_SERVERS 4
+#define SNTP_SERVER_NAME_LEN 64
+#define SNTP_SERVER_LIST_LEN 128
+
+typedef struct {
+    char name[SNTP_SERVER_NAME_LEN];
+    uint8_t reach;  // Last 8 polls, newest in bit 0: 1 = answered
+    int64_t delay_us;
+} sntp_server_stats_t;
+
+typedef struct {
+    bool synced;
+    int64_t offset_us;  // Last measured offset, before correction
+    int64_t delay_us;
+    int64_t jitter_us;
+    int32_t drift_ppb;  // Frequency correction applied to the clock
+    uint32_t poll_s;
+    int64_t last_sync_age_s;  // -1 before the first sync
+    uint32_t polls;
+    uint32_t failures;  // Polls no server answered
+    uint32_t steps;
+    int server_count;
+    int current_server;  // Polled last, -1 if none yet
+    sntp_server_stats_t servers[SNTP_MAX_SERVERS];
+} sntp_stats_t;
+
+void sntp_init(void);
 void sync_sntp(void);
+void sntp_load_timezone(void);
+void sntp_set_servers(const char* list);
+void sntp_get_stats(sntp_stats_t* stats);
 
 #endif /* SNTP_H */
@@ -0,0 +1,49 @@
+#ifndef STATIC_ALLOC_H
+#define STATIC_ALLOC_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+/* Task, queue and mutex creation that, with CONFIG_STATIC_ALLOC, takes its
+memory from static storage reserved at each call site instead of the heap.
+Each use reserves its own storage, so a site must create its object only
+once. The values are those of the FreeRTOS calls they stand for. */
+#if CONFIG_STATIC_ALLOC
+
+#define TASK_CREATE(fn, name, stack, arg, prio, handle)                    \
+    ({                                                                     \
+        static StackType_t task_stack_[stack];                             \
+        static StaticTask_t task_tcb_;                                     \
+        TaskHandle_t* task_out_ = (handle);                                \
+        TaskHandle_t task_ = xTaskCreateStatic(fn, name, stack, arg, prio, \
+                                               task_stack_, &task_tcb_);   \
+        if (task_out_ != NULL) *task_out_ = task_;                         \
+        task_ != NULL ? pdPASS : errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;    \
+    })
+
+#define QUEUE_CREATE(length, item_size)                                 \
+    ({                                                                  \
+        static uint8_t queue_storage_[(length) * (item_size)];          \
+        static StaticQueue_t queue_;                                    \
+        xQueueCreateStatic(length, item_size, queue_storage_, &queue_); \
+    })
+
+#define MUTEX_CREATE()                        \
+    ({                                        \
+        static StaticSemaphore_t mutex_;      \
+        xSemaphoreCreateMutexStatic(&mutex_); \
+    })
+
+#else
+
+#define TASK_CREATE(fn, name, stack, arg, prio, handle) \
+    xTaskCreate(fn, name, stack, arg, prio, handle)
+#define QUEUE_CREATE(length, item_size) xQueueCreate(length, item_size)
+#define MUTEX_CREATE() xSemaphoreCreateMutex()
+
+#endif
+
+#endif /* STATIC_ALLOC_H */
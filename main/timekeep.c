@@ -0,0 +1,201 @@
+#include "timekeep.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_rtc_time.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define TIMEKEEP_NVS_NAMESPACE "timekeep"
+#define TIMEKEEP_NVS_KEY "last"
+#define TIMEKEEP_MAGIC 0x54494d45  // "TIME"
+
+// Anything before 2016 is the epoch the chip boots with, not a real time
+#define TIMEKEEP_VALID_AFTER_US (1451606400LL * 1000000)
+
+// Syncs closer together than this give too noisy a drift sample
+#define DRIFT_MIN_SPAN_US (10 * 60 * 1000000LL)
+// Beyond this the sample is a clock step, not drift
+#define DRIFT_MAX_PPB 1000000
+
+static const char* TAG = "timekeep";
+
+/* The same record is kept in RTC memory and in NVS. In NVS rtc_us is
+meaningless: the RTC timer does not survive the power loss that makes the
+NVS copy necessary. */
+typedef struct {
+    int64_t unix_us;    // Wall-clock time...
+    int64_t rtc_us;     // ...at this RTC timer reading
+    int32_t drift_ppb;  // System clock rate error against NTP
+    uint32_t magic;
+    uint32_t crc;
+} timekeep_record_t;
+
+static RTC_NOINIT_ATTR timekeep_record_t rtc_record;
+
+static int32_t drift_ppb = 0;
+static bool drift_known = false;
+static int64_t last_sync_mono_us = 0;
+static int64_t last_sync_unix_us = 0;
+
+static int64_t last_nvs_save_us = 0;
+static volatile bool nvs_save_now = false;
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void set_wall_us(int64_t us) {
+    struct timeval tv = {.tv_sec = us / 1000000, .tv_usec = us % 1000000};
+    settimeofday(&tv, NULL);
+}
+
+static uint32_t record_crc(const timekeep_record_t* r) {
+    return esp_rom_crc32_le(0, (const uint8_t*)r,
+                            offsetof(timekeep_record_t, crc));
+}
+
+static void fill_record(timekeep_record_t* r, int64_t unix_us) {
+    r->unix_us = unix_us;
+    r->rtc_us = (int64_t)esp_rtc_get_time_us();
+    r->drift_ppb = drift_ppb;
+    r->magic = TIMEKEEP_MAGIC;
+    r->crc = record_crc(r);
+}
+
+static bool load_nvs(timekeep_record_t* r) {
+    nvs_handle_t handle;
+    if (nvs_open(TIMEKEEP_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(*r);
+    esp_err_t ret = nvs_get_blob(handle, TIMEKEEP_NVS_KEY, r, &size);
+    nvs_close(handle);
+
+    return ret == ESP_OK && size == sizeof(*r) && r->magic == TIMEKEEP_MAGIC &&
+           r->crc == record_crc(r);
+}
+
+/* The handle stays open between saves, since each nvs_open allocates. */
+static nvs_handle_t save_handle = 0;
+
+static esp_err_t open_for_save(void) {
+    if (save_handle != 0) return ESP_OK;
+    esp_err_t ret =
+        nvs_open(TIMEKEEP_NVS_NAMESPACE, NVS_READWRITE, &save_handle);
+    if (ret != ESP_OK) save_handle = 0;
+    return ret;
+}
+
+static void save_nvs(int64_t unix_us) {
+    timekeep_record_t r;
+    fill_record(&r, unix_us);
+
+    esp_err_t ret = open_for_save();
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(save_handle, TIMEKEEP_NVS_KEY, &r, sizeof(r));
+        if (ret == ESP_OK) ret = nvs_commit(save_handle);
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save time (%s)", esp_err_to_name(ret));
+    }
+}
+
+/* Set the system time to the best estimate available. Runs first thing in
+app_main, before anything reads the time. */
+void timekeep_restore(void) {
+    esp_reset_reason_t reason = esp_reset_reason();
+    // RTC memory and the RTC timer only carry over a reset, not a power cycle
+    bool rtc_ok = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT &&
+                  rtc_record.magic == TIMEKEEP_MAGIC &&
+                  rtc_record.crc == record_crc(&rtc_record);
+    int64_t rtc_now = (int64_t)esp_rtc_get_time_us();
+    timekeep_record_t saved;
+
+    last_nvs_save_us = esp_timer_get_time();
+
+    if (wall_us() >= TIMEKEEP_VALID_AFTER_US) {
+        ESP_LOGI(TAG, "System time survived the reset");
+    } else if (rtc_ok && rtc_now >= rtc_record.rtc_us) {
+        set_wall_us(rtc_record.unix_us + (rtc_now - rtc_record.rtc_us));
+        ESP_LOGI(TAG, "Time restored from RTC memory (%lld ms since saved)",
+                 (rtc_now - rtc_record.rtc_us) / 1000);
+    } else if (load_nvs(&saved)) {
+        rtc_record = saved;
+        rtc_ok = true;
+        set_wall_us(saved.unix_us);
+        ESP_LOGW(TAG, "Time restored from NVS; it lags by the power outage");
+    } else {
+        ESP_LOGW(TAG, "No saved time, the tubes stay dark until SNTP");
+        return;
+    }
+
+    if (rtc_ok) {
+        drift_ppb = rtc_record.drift_ppb;
+        drift_known = drift_ppb != 0;
+    }
+    fill_record(&rtc_record, wall_us());
+}
+
+/* Mirror the time into RTC memory, and into NVS every
+CONFIG_TIMEKEEP_NVS_SAVE_MIN minutes or after a sync. Called by the display
+task once a second. */
+void timekeep_tick(void) {
+    int64_t now = wall_us();
+    if (now < TIMEKEEP_VALID_AFTER_US) return;
+
+    fill_record(&rtc_record, now);
+
+    int64_t mono = esp_timer_get_time();
+    if (nvs_save_now ||
+        mono - last_nvs_save_us >=
+            (int64_t)CONFIG_TIMEKEEP_NVS_SAVE_MIN * 60000000LL) {
+        nvs_save_now = false;
+        last_nvs_save_us = mono;
+        save_nvs(now);
+    }
+}
+
+/* SNTP set the time to `tv`. Compare the time elapsed since the previous sync
+with what esp_timer, which the system time runs on between syncs, counted
+for it: the difference is the drift of the crystal. */
+void timekeep_synced(const struct timeval* tv) {
+    int64_t mono = esp_timer_get_time();
+    int64_t unix_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    int64_t local_us = mono - last_sync_mono_us;
+
+    if (last_sync_mono_us != 0 && local_us >= DRIFT_MIN_SPAN_US) {
+        int64_t error_us = (unix_us - last_sync_unix_us) - local_us;
+        if (llabs(error_us) <= local_us / (1000000000LL / DRIFT_MAX_PPB)) {
+            int32_t sample = (int32_t)(error_us * 1000000000LL / local_us);
+            drift_ppb = drift_known ? (3 * drift_ppb + sample) / 4 : sample;
+            drift_known = true;
+            ESP_LOGI(TAG, "Drift %+ld ppb (sample %+ld ppb over %lld s)",
+                     (long)drift_ppb, (long)sample, local_us / 1000000);
+        }
+    }
+
+    last_sync_mono_us = mono;
+    last_sync_unix_us = unix_us;
+    // Written by the display task, keeping flash writes off the SNTP path
+    nvs_save_now = true;
+}
+
+/* Estimated rate error of the system clock, in parts per billion; positive
+when it runs slow. 0 until two syncs far enough apart, or a saved value. */
+int32_t timekeep_drift_ppb(void) {
+    return drift_ppb;
+}
+
+/* Whether the system time was restored or synced, rather than counting up
+from the epoch since boot. */
+bool timekeep_valid(void) {
+    return wall_us() >= TIMEKEEP_VALID_AFTER_US;
+}
@@ -0,0 +1,19 @@
+#ifndef TIMEKEEP_H
+#define TIMEKEEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* Holdover of the wall-clock time across resets and power loss, so the
+display can show a best estimate before the network is up. The time is
+mirrored every second into RTC memory, which survives resets, and every
+CONFIG_TIMEKEEP_NVS_SAVE_MIN minutes into NVS, which survives power loss
+(the outage itself is then unaccounted for). */
+void timekeep_restore(void);
+void timekeep_tick(void);
+void timekeep_synced(const struct timeval* tv);
+int32_t timekeep_drift_ppb(void);
+bool timekeep_valid(void);
+
+#endif /* TIMEKEEP_H */
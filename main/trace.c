@@ -0,0 +1,140 @@
+#include "trace.h"
+
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+
+#include "resp_buf.h"
+
+#if CONFIG_TRACE_ENABLE
+
+#define TRACE_EVENTS (1u << CONFIG_TRACE_EVENTS_LOG2)
+#define TRACE_MASK (TRACE_EVENTS - 1)
+#define TRACE_MAX_TASKS 32
+#define TRACE_ISR_TID 0
+
+typedef struct {
+    uint32_t cycles;
+    const char* name;
+    TaskHandle_t task;  // NULL for an ISR
+    char phase;         // Chrome trace "ph": 'B', 'E' or 'i'
+} trace_event_t;
+
+typedef struct {
+    uint32_t head;  // Events ever recorded; the ring keeps the last ones
+    trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+static trace_ring_t rings[portNUM_PROCESSORS];
+static volatile bool paused = false;
+static TaskStatus_t tasks[TRACE_MAX_TASKS];  // Only the httpd task exports
+
+void IRAM_ATTR trace_record(const char* name, char phase) {
+    if (paused) return;
+
+    UBaseType_t irq = portSET_INTERRUPT_MASK_FROM_ISR();
+    trace_ring_t* ring = &rings[esp_cpu_get_core_id()];
+    trace_event_t* event = &ring->events[ring->head++ & TRACE_MASK];
+    event->cycles = esp_cpu_get_cycle_count();
+    event->name = name;
+    event->task = xPortInIsrContext() ? NULL : xTaskGetCurrentTaskHandle();
+    event->phase = phase;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq);
+}
+
+/* Trace thread id of a task: its FreeRTOS task number while it exists, or
+one made from the handle for a task deleted since. */
+static int thread_id(TaskHandle_t task, const TaskStatus_t* tasks, int n) {
+    if (task == NULL) return TRACE_ISR_TID;
+    for (int i = 0; i < n; i++) {
+        if (tasks[i].xHandle == task) return tasks[i].xTaskNumber;
+    }
+    return 0x10000 | (((uintptr_t)task >> 2) & 0xffff);
+}
+
+static void send_names(resp_buf_t* out, const TaskStatus_t* tasks, int n) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        resp_buf_printf(out,
+                        "%s{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"Core %d\"}}",
+                        core == 0 ? "" : ",", core, core);
+        resp_buf_printf(out,
+                        ",{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                        "\"tid\":%d,\"args\":{\"name\":\"ISR\"}}",
+                        core, TRACE_ISR_TID);
+        for (int i = 0; i < n; i++) {
+            resp_buf_printf(out,
+                            ",{\"ph\":\"M\",\"name\":\"thread_name\","
+                            "\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"name\":\"%s\"}}",
+                            core, (int)tasks[i].xTaskNumber,
+                            tasks[i].pcTaskName);
+        }
+    }
+}
+
+/* Events of one core, oldest first. Cycle counts are 32 bits, so they are
+widened by counting wraps between consecutive events; that holds as long
+as no core goes one wrap (26 s at 160 MHz) without an event, which the
+once-a-second latch makes sure of. */
+static void send_ring(resp_buf_t* out, int core, const TaskStatus_t* tasks,
+                      int n) {
+    const trace_ring_t* ring = &rings[core];
+    uint32_t head = ring->head;
+    uint32_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+    uint64_t wraps = 0;
+    uint32_t last = 0;
+
+    for (uint32_t i = head - count; i != head; i++) {
+        const trace_event_t* event = &ring->events[i & TRACE_MASK];
+        if (i != head - count && event->cycles < last) wraps++;
+        last = event->cycles;
+
+        uint64_t cycles = (wraps << 32) | event->cycles;
+        resp_buf_printf(out,
+                        ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d%s}",
+                        event->name, event->phase,
+                        (double)cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+                        core, thread_id(event->task, tasks, n),
+                        event->phase == 'i' ? ",\"s\":\"t\"" : "");
+    }
+}
+
+/* Download the rings as Chrome trace JSON, for chrome://tracing or
+ui.perfetto.dev. Recording pauses meanwhile so the rings hold still. */
+esp_err_t trace_send(struct httpd_req* req) {
+    paused = true;
+
+    // Names of the tasks that still exist
+    int n = uxTaskGetSystemState(tasks, TRACE_MAX_TASKS, NULL);
+
+    resp_buf_t out;
+    resp_buf_init(&out, req);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition",
+                       "attachment; filename=\"trace.json\"");
+
+    resp_buf_printf(&out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    send_names(&out, tasks, n);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        send_ring(&out, core, tasks, n);
+    }
+    resp_buf_printf(&out, "]}");
+
+    paused = false;
+    return resp_buf_finish(&out);
+}
+
+#else
+
+esp_err_t trace_send(struct httpd_req* req) {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND,
+                        "Tracing is off in this build (CONFIG_TRACE_ENABLE)");
+    return ESP_OK;
+}
+
+#endif
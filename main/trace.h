@@ -0,0 +1,28 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <esp_err.h>
+#include <sdkconfig.h>
+
+struct httpd_req;
+
+/* Cross-task event trace. Each core appends timestamped events to its own
+ring, with interrupts masked on that core only for the few stores of one
+event, so recording is safe from tasks and ISRs and never waits on another
+core. Names must be string literals or otherwise live forever: only the
+pointer is kept. With CONFIG_TRACE_ENABLE off the macros compile to
+nothing. */
+#if CONFIG_TRACE_ENABLE
+#define TRACE_BEGIN(name) trace_record((name), 'B')
+#define TRACE_END(name) trace_record((name), 'E')
+#define TRACE_INSTANT(name) trace_record((name), 'i')
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#endif
+
+void trace_record(const char* name, char phase);
+esp_err_t trace_send(struct httpd_req* req);
+
+#endif /* TRACE_H */
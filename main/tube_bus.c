@@ -0,0 +1,232 @@
+#include "tube_bus.h"
+
+#include <driver/gpio.h>
+#include <driver/spi_master.h>
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <hal/gpio_ll.h>
+#include <stdbool.h>
+
+#include "clock.h"
+#include "trace.h"
+
+#define TUBE_SPI_HOST SPI2_HOST
+#define BENCH_FRAMES 256
+
+static const char* TAG = "tube_bus";
+
+/* Copy the shift stage to the outputs. Safe to call from ISR context, which
+is how both the SPI completion callback and the second-edge timer use it. */
+void IRAM_ATTR tube_bus_latch(void) {
+    TRACE_INSTANT("latch");
+    gpio_ll_set_level(&GPIO, LATCH_PIN, 1);
+    esp_rom_delay_us(1);
+    gpio_ll_set_level(&GPIO, LATCH_PIN, 0);
+}
+
+/* GPIO bit-bang backend: the original transport, kept as a fallback for
+boards where the SPI peripheral is needed elsewhere. */
+
+static esp_err_t gpio_tube_init(void) {
+    gpio_config_t io_conf = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_OUTPUT,
+        .pin_bit_mask = (1ULL << DATA_PIN) | (1ULL << CLOCK_PIN),
+        .pull_down_en = 0,
+        .pull_up_en = 0};
+
+    esp_err_t ret = gpio_config(&io_conf);
+    gpio_set_level(CLOCK_PIN, 0);
+    return ret;
+}
+
+static void gpio_tube_deinit(void) {
+}
+
+static void gpio_tube_shift(uint64_t frame) {
+    for (int i = 63; i >= 0; i--) {
+        gpio_set_level(DATA_PIN, (frame >> i) & 0x01);
+        gpio_set_level(CLOCK_PIN, 1);
+        esp_rom_delay_us(2);
+        gpio_set_level(CLOCK_PIN, 0);
+        esp_rom_delay_us(2);
+    }
+}
+
+static void gpio_tube_write(uint64_t frame) {
+    gpio_tube_shift(frame);
+    tube_bus_latch();
+}
+
+static void gpio_tube_flush(void) {
+}
+
+/* SPI master backend: DATA_PIN/CLOCK_PIN are routed to SPI2 MOSI/SCLK and the
+frame goes out as one DMA transaction. The caller only pays for queueing; when
+the transaction's `user` field is set the latch pulse is issued from the
+post-transaction callback in ISR context. */
+
+static spi_device_handle_t spi_dev = NULL;
+static spi_transaction_t spi_trans;
+static DMA_ATTR WORD_ALIGNED_ATTR uint8_t spi_tx_buf[8];
+static bool spi_in_flight = false;
+
+static void IRAM_ATTR spi_post_cb(spi_transaction_t* t) {
+    if (t->user) {
+        tube_bus_latch();
+    }
+}
+
+static esp_err_t spi_tube_init(void) {
+    spi_bus_config_t bus_cfg = {.mosi_io_num = DATA_PIN,
+                                .miso_io_num = -1,
+                                .sclk_io_num = CLOCK_PIN,
+                                .quadwp_io_num = -1,
+                                .quadhd_io_num = -1,
+                                .max_transfer_sz = sizeof(spi_tx_buf)};
+
+    esp_err_t ret =
+        spi_bus_initialize(TUBE_SPI_HOST, &bus_cfg, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize SPI bus (%s)",
+                 esp_err_to_name(ret));
+        return ret;
+    }
+
+    // 74HC595 samples SER on the rising edge of SRCLK: SPI mode 0
+    spi_device_interface_config_t dev_cfg = {
+        .clock_speed_hz = CONFIG_TUBE_BUS_SPI_CLOCK_HZ,
+        .mode = 0,
+        .spics_io_num = -1,
+        .queue_size = 1,
+        .post_cb = spi_post_cb};
+
+    ret = spi_bus_add_device(TUBE_SPI_HOST, &dev_cfg, &spi_dev);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add SPI device (%s)", esp_err_to_name(ret));
+        spi_bus_free(TUBE_SPI_HOST);
+        return ret;
+    }
+
+    spi_in_flight = false;
+    return ESP_OK;
+}
+
+static void spi_tube_flush(void) {
+    if (spi_in_flight) {
+        spi_transaction_t* done;
+        spi_device_get_trans_result(spi_dev, &done, portMAX_DELAY);
+        spi_in_flight = false;
+    }
+}
+
+static void spi_tube_deinit(void) {
+    spi_tube_flush();
+    spi_bus_remove_device(spi_dev);
+    spi_bus_free(TUBE_SPI_HOST);
+    spi_dev = NULL;
+}
+
+static void spi_tube_queue(uint64_t frame, bool latch) {
+    // The buffer is owned by the DMA until the previous frame is reaped
+    spi_tube_flush();
+
+    for (int i = 0; i < 8; i++) {
+        spi_tx_buf[i] = (uint8_t)(frame >> (56 - 8 * i));
+    }
+
+    spi_trans = (spi_transaction_t){
+        .length = 64, .tx_buffer = spi_tx_buf, .user = (void*)latch};
+    if (spi_device_queue_trans(spi_dev, &spi_trans, portMAX_DELAY) == ESP_OK) {
+        spi_in_flight = true;
+    }
+}
+
+static void spi_tube_write(uint64_t frame) {
+    spi_tube_queue(frame, true);
+}
+
+static void spi_tube_shift(uint64_t frame) {
+    spi_tube_queue(frame, false);
+}
+
+static const tube_bus_t gpio_tube_bus = {.name = "gpio",
+                                         .init = gpio_tube_init,
+                                         .deinit = gpio_tube_deinit,
+                                         .write = gpio_tube_write,
+                                         .shift = gpio_tube_shift,
+                                         .flush = gpio_tube_flush};
+
+static const tube_bus_t spi_tube_bus = {.name = "spi",
+                                        .init = spi_tube_init,
+                                        .deinit = spi_tube_deinit,
+                                        .write = spi_tube_write,
+                                        .shift = spi_tube_shift,
+                                        .flush = spi_tube_flush};
+
+#if CONFIG_TUBE_BUS_SPI
+static const tube_bus_t* bus = &spi_tube_bus;
+#else
+static const tube_bus_t* bus = &gpio_tube_bus;
+#endif
+
+static void benchmark_bus(const tube_bus_t* b) {
+    if (b->init() != ESP_OK) {
+        ESP_LOGE(TAG, "Benchmark: %s backend failed to initialize", b->name);
+        return;
+    }
+
+    uint32_t busy_cycles = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        uint64_t frame = 0xA5A5A5A5A5A5A5A5ULL ^ ((uint64_t)i << 17);
+        uint32_t c0 = esp_cpu_get_cycle_count();
+        b->write(frame);
+        busy_cycles += esp_cpu_get_cycle_count() - c0;
+        b->flush();
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    b->deinit();
+
+    ESP_LOGI(TAG,
+             "Benchmark %s: %u CPU cycles/frame in caller, %u us/frame "
+             "end-to-end",
+             b->name, (unsigned int)(busy_cycles / BENCH_FRAMES),
+             (unsigned int)(elapsed_us / BENCH_FRAMES));
+}
+
+/* Time both backends over the same frames. Run before HVEN is raised so the
+garbage frames are never visible. */
+void tube_bus_benchmark(void) {
+    benchmark_bus(&gpio_tube_bus);
+    benchmark_bus(&spi_tube_bus);
+}
+
+esp_err_t tube_bus_init(void) {
+#if CONFIG_TUBE_BUS_BENCHMARK
+    tube_bus_benchmark();
+#endif
+    ESP_LOGI(TAG, "Using %s transport", bus->name);
+    return bus->init();
+}
+
+void tube_bus_write(uint64_t frame) {
+    TRACE_BEGIN("shift-out");
+    bus->write(frame);
+    TRACE_END("shift-out");
+}
+
+void tube_bus_shift(uint64_t frame) {
+    TRACE_BEGIN("shift-out");
+    bus->shift(frame);
+    TRACE_END("shift-out");
+}
+
+void tube_bus_flush(void) {
+    TRACE_BEGIN("shift-out wait");
+    bus->flush();
+    TRACE_END("shift-out wait");
+}
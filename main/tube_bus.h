@@ -0,0 +1,27 @@
+#ifndef TUBE_BUS_H
+#define TUBE_BUS_H
+
+#include <esp_err.h>
+#include <stdint.h>
+
+// Transport used to clock a 64-bit frame into the 74HC595 chain. `write`
+// shifts the frame (MSB first) and pulses LATCH_PIN once it is in place;
+// `shift` only loads the shift stage and leaves the outputs untouched.
+// `flush` blocks until any frame still in flight has been shifted out.
+typedef struct {
+    const char* name;
+    esp_err_t (*init)(void);
+    void (*deinit)(void);
+    void (*write)(uint64_t frame);
+    void (*shift)(uint64_t frame);
+    void (*flush)(void);
+} tube_bus_t;
+
+esp_err_t tube_bus_init(void);
+void tube_bus_write(uint64_t frame);
+void tube_bus_shift(uint64_t frame);
+void tube_bus_latch(void);
+void tube_bus_flush(void);
+void tube_bus_benchmark(void);
+
+#endif /* TUBE_BUS_H */
@@ -0,0 +1,230 @@
+#include "tz.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "static_alloc.h"
+
+#define SECS_PER_DAY 86400
+/* Transitions are found by probing the libc conversion a week apart and
+bisecting where the offset changed. Real rules keep an offset for months;
+two transitions within one probe step would be missed. */
+#define TZ_PROBE_S (7 * SECS_PER_DAY)
+#define TZ_MAX_ENTRIES (2 * CONFIG_TZ_TABLE_YEARS + 2)
+
+static const char* TAG = "tz";
+
+typedef struct {
+    time_t from;
+    int32_t offset_s;
+    bool isdst;
+} tz_entry_t;
+
+typedef struct {
+    uint32_t seq;  // Odd while the table is being rebuilt
+    time_t until;  // End of coverage; entries[0].from is the start
+    int count;
+    int hint;  // Entry of the last lookup: the next transition is cached
+    tz_entry_t entries[TZ_MAX_ENTRIES];
+} tz_table_t;
+
+/* Two tables: readers use the active one while the other is rebuilt, then
+the pointer is swapped. Readers check the sequence number of the table
+they read, so one reused by a second rebuild meanwhile is noticed. */
+static tz_table_t tables[2];
+static tz_table_t* active = NULL;
+static uint32_t generation = 0;
+
+static SemaphoreHandle_t build_lock = NULL;
+static char spec_now[TZ_SPEC_LEN];  // What the active table was built from
+
+static int64_t days_from_civil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097LL + doe - 719468;
+}
+
+/* UTC offset and DST flag of the current TZ rules at `t`, the slow way. */
+static int32_t probe(time_t t, bool* isdst) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    *isdst = tm.tm_isdst > 0;
+    int64_t local = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1,
+                                    tm.tm_mday) *
+                        SECS_PER_DAY +
+                    tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    return (int32_t)(local - t);
+}
+
+static void build(tz_table_t* tbl, time_t around) {
+    time_t from = around - SECS_PER_DAY;
+    time_t until =
+        around + (time_t)CONFIG_TZ_TABLE_YEARS * 365 * SECS_PER_DAY;
+    bool dst;
+    int32_t off = probe(from, &dst);
+    int n = 0;
+
+    tbl->entries[n++] = (tz_entry_t){from, off, dst};
+    for (time_t prev = from; prev < until;) {
+        time_t t = (until - prev > TZ_PROBE_S) ? prev + TZ_PROBE_S : until;
+        bool t_dst;
+        if (probe(t, &t_dst) != off || t_dst != dst) {
+            // First second with the new offset
+            time_t lo = prev;
+            time_t hi = t;
+            while (hi - lo > 1) {
+                time_t mid = lo + (hi - lo) / 2;
+                bool mid_dst;
+                if (probe(mid, &mid_dst) == off && mid_dst == dst) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (n == TZ_MAX_ENTRIES) {
+                until = hi;
+                break;
+            }
+            off = probe(hi, &dst);
+            tbl->entries[n++] = (tz_entry_t){hi, off, dst};
+        }
+        prev = t;
+    }
+
+    tbl->count = n;
+    tbl->until = until;
+    tbl->hint = 0;
+}
+
+/* Rebuild the table aside for the TZ in the environment and swap it in.
+Call with build_lock held. */
+static void publish(time_t around) {
+    tz_table_t* next = (active == &tables[0]) ? &tables[1] : &tables[0];
+    int64_t start = esp_timer_get_time();
+
+    __atomic_add_fetch(&next->seq, 1, __ATOMIC_RELEASE);
+    build(next, around);
+    __atomic_add_fetch(&next->seq, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&active, next, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+
+    ESP_LOGI(TAG, "\"%s\": %d transitions in %d years, built in %lld us",
+             spec_now, next->count - 1, CONFIG_TZ_TABLE_YEARS,
+             esp_timer_get_time() - start);
+}
+
+static bool find(tz_table_t* tbl, time_t t, tz_span_t* span) {
+    int n = tbl->count;
+    if (n == 0 || t < tbl->entries[0].from || t >= tbl->until) return false;
+
+    int i = tbl->hint;
+    if (i >= n || t < tbl->entries[i].from ||
+        (i + 1 < n && t >= tbl->entries[i + 1].from)) {
+        // Last entry starting at or before t
+        int lo = 0;
+        int hi = n - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (tbl->entries[mid].from <= t) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        i = lo;
+        tbl->hint = i;
+    }
+
+    span->from = tbl->entries[i].from;
+    span->until = (i + 1 < n) ? tbl->entries[i + 1].from : tbl->until;
+    span->offset_s = tbl->entries[i].offset_s;
+    span->isdst = tbl->entries[i].isdst;
+    return true;
+}
+
+/* Lock-free lookup. False if `t` is not covered, or if the table changed
+under us; the caller then takes the build lock, which also waits out a
+rebuild in progress. */
+static bool lookup(time_t t, tz_span_t* span) {
+    tz_table_t* tbl = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    if (tbl == NULL) return false;
+
+    uint32_t seq = __atomic_load_n(&tbl->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return false;
+    bool found = find(tbl, t, span);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return found && __atomic_load_n(&tbl->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* Make sure the table covers `t`, rebuilding it around `t` if not. */
+static void cover(time_t t) {
+    tz_span_t span;
+
+    xSemaphoreTake(build_lock, portMAX_DELAY);
+    if (!lookup(t, &span)) publish(t);
+    xSemaphoreGive(build_lock);
+}
+
+void tz_init(void) {
+    build_lock = MUTEX_CREATE();
+}
+
+/* Switch to the POSIX TZ rules in `spec`, e.g. "PST8PDT,M3.2.0,M11.1.0".
+The libc environment is updated as well, for strftime() and friends.
+Returns false if `spec` is already in use. */
+bool tz_set(const char* spec) {
+    bool changed = false;
+
+    xSemaphoreTake(build_lock, portMAX_DELAY);
+    if (active == NULL || strncmp(spec, spec_now, sizeof(spec_now)) != 0) {
+        strncpy(spec_now, spec, sizeof(spec_now) - 1);
+        spec_now[sizeof(spec_now) - 1] = '\0';
+        setenv("TZ", spec_now, 1);
+        tzset();
+
+        time_t now;
+        time(&now);
+        publish(now);
+        changed = true;
+    }
+    xSemaphoreGive(build_lock);
+    return changed;
+}
+
+/* Local time at `t`, and optionally the span of constant offset around it.
+A table lookup and gmtime_r() of the shifted time; only a time outside the
+table's coverage costs a rebuild. */
+void tz_localtime(time_t t, struct tm* out, tz_span_t* span) {
+    tz_span_t s;
+
+    if (!lookup(t, &s)) {
+        cover(t);
+        if (!lookup(t, &s)) {
+            // Swapped again meanwhile; this second stands on its own
+            localtime_r(&t, out);
+            if (span != NULL) {
+                *span = (tz_span_t){.from = t, .until = t + 1};
+                span->offset_s = probe(t, &span->isdst);
+            }
+            return;
+        }
+    }
+
+    time_t local = t + s.offset_s;
+    gmtime_r(&local, out);
+    out->tm_isdst = s.isdst;
+    if (span != NULL) *span = s;
+}
+
+/* Changes whenever a new table is swapped in, so cached conversions can tell
+they are stale. */
+uint32_t tz_generation(void) {
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
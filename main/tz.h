@@ -0,0 +1,27 @@
+#ifndef TZ_H
+#define TZ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TZ_SPEC_LEN 64
+
+// One stretch of constant UTC offset: [from, until)
+typedef struct {
+    time_t from;
+    time_t until;
+    int32_t offset_s;  // Local time minus UTC
+    bool isdst;
+} tz_span_t;
+
+/* POSIX TZ rules compiled into a table of UTC offset transitions covering
+CONFIG_TZ_TABLE_YEARS around the time it was built, so converting to local
+time is a table lookup and an add. Readers never block; tz_set() builds the
+new table aside and swaps it in. */
+void tz_init(void);
+bool tz_set(const char* spec);
+void tz_localtime(time_t t, struct tm* out, tz_span_t* span);
+uint32_t tz_generation(void);
+
+#endif /* TZ_H */
@@ -1,18 +1,39 @@
 #include "vfs.h"
 
+#include <dirent.h>
+#include <errno.h>
 #include <esp_log.h>
 #include <esp_spiffs.h>
+#include <esp_timer.h>
 #include <esp_vfs_semihost.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if CONFIG_VFS_LITTLEFS
+#include <esp_littlefs.h>
+#endif
+
+#define VFS_BASE_PATH "/spiffs"
+// Where the SPIFFS partition goes while LittleFS has VFS_BASE_PATH
+#define SPIFFS_SIDE_PATH "/old"
+#define MIGRATED_MARKER VFS_BASE_PATH "/.migrated"
+#define VFS_PATH_LEN 64
+#define COPY_BLOCK_SIZE 512
 
 static const char* TAG = "vfs";
 
-static const esp_vfs_spiffs_conf_t conf = {.base_path = "/spiffs",
-                                           .partition_label = NULL,
+// Named, since the LittleFS partition may have the SPIFFS subtype as well
+static const esp_vfs_spiffs_conf_t conf = {.base_path = VFS_BASE_PATH,
+                                           .partition_label = "storage",
                                            .max_files = 10,
                                            .format_if_mount_failed = true};
 
-/* Initialize and register vfs */
-esp_err_t vfs_init(void) {
+#if !CONFIG_VFS_LITTLEFS
+/* Mount the SPIFFS partition at VFS_BASE_PATH. */
+static esp_err_t mount_spiffs(void) {
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
 
     if (ret != ESP_OK) {
@@ -59,12 +80,243 @@ esp_err_t vfs_init(void) {
 
     return ESP_OK;
 }
+#endif
+
+#if CONFIG_VFS_LITTLEFS
+/* Same base path as SPIFFS, so the rest of the firmware is none the wiser */
+static const esp_vfs_littlefs_conf_t littlefs_conf = {
+    .base_path = VFS_BASE_PATH,
+    .partition_label = CONFIG_VFS_LITTLEFS_PARTITION,
+    .format_if_mount_failed = true};
+
+static esp_err_t mount_littlefs(void) {
+    esp_err_t ret = esp_vfs_littlefs_register(&littlefs_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount LittleFS (%s)", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+/* The SPIFFS partition at SPIFFS_SIDE_PATH, never formatted. It is mounted
+writable, as esp_spiffs has no read-only mode; migrate() only reads it. */
+static esp_err_t mount_spiffs_aside(void) {
+    esp_vfs_spiffs_conf_t aside = conf;
+    aside.base_path = SPIFFS_SIDE_PATH;
+    aside.format_if_mount_failed = false;
+    return esp_vfs_spiffs_register(&aside);
+}
+
+/* SPIFFS is flat, and a '/' in a file name is just another character, but
+on LittleFS it separates directories. Create those `path` needs under
+VFS_BASE_PATH. */
+static esp_err_t make_parents(char* path) {
+    char* p = strchr(path + strlen(VFS_BASE_PATH) + 1, '/');
+    for (; p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        bool ok = mkdir(path, 0775) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok) return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t copy_file(const char* from, const char* to, size_t* bytes) {
+    FILE* in = fopen(from, "r");
+    if (in == NULL) return ESP_FAIL;
+    FILE* out = fopen(to, "w");
+    if (out == NULL) {
+        fclose(in);
+        return ESP_FAIL;
+    }
+
+    char buf[COPY_BLOCK_SIZE];
+    bool ok = true;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ok = false;
+            break;
+        }
+        *bytes += n;
+    }
+    ok = !ferror(in) && ok;
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    if (!ok) unlink(to);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+/* On the first boot with LittleFS, copy over the files of the SPIFFS
+partition it does not have yet, such as those saved at run time when only
+the app was flashed. A failed copy is retried on the next boot; after a
+complete one, the marker file stops any further. */
+static void migrate(void) {
+    struct stat st;
+    if (stat(MIGRATED_MARKER, &st) == 0) return;
+
+    if (mount_spiffs_aside() != ESP_OK) {
+        ESP_LOGI(TAG, "No SPIFFS partition to migrate");
+    } else {
+        DIR* dir = opendir(SPIFFS_SIDE_PATH);
+        struct dirent* entry;
+        int files = 0;
+        size_t bytes = 0;
+        bool ok = dir != NULL;
+        while (dir != NULL && (entry = readdir(dir)) != NULL) {
+            char from[VFS_PATH_LEN], to[VFS_PATH_LEN];
+            if (snprintf(from, sizeof(from), "%s/%s", SPIFFS_SIDE_PATH,
+                         entry->d_name) >= (int)sizeof(from) ||
+                snprintf(to, sizeof(to), "%s/%s", VFS_BASE_PATH,
+                         entry->d_name) >= (int)sizeof(to)) {
+                // Could never be copied, so it does not hold up the marker
+                ESP_LOGE(TAG, "Name too long to migrate, skipped: %s",
+                         entry->d_name);
+                continue;
+            }
+            if (stat(to, &st) == 0) continue;
+            if (make_parents(to) != ESP_OK ||
+                copy_file(from, to, &bytes) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to migrate %s", entry->d_name);
+                ok = false;
+                continue;
+            }
+            files++;
+        }
+        if (dir != NULL) closedir(dir);
+        esp_vfs_spiffs_unregister(conf.partition_label);
+        if (!ok) return;
+        ESP_LOGI(TAG, "Migrated %d files of %u bytes from SPIFFS", files,
+                 (unsigned int)bytes);
+    }
+
+    FILE* f = fopen(MIGRATED_MARKER, "w");
+    if (f != NULL) fclose(f);
+}
+
+#if CONFIG_VFS_BENCHMARK
+#define BENCH_REWRITES 20
+#define BENCH_FILE "bench.json"
+#define BENCH_FILE_SIZE 600  // About that of config.json
+#define BENCH_MP3 "GetOnGoodFoot.mp3"
+
+typedef struct {
+    int64_t mount_us;
+    int64_t rewrite_avg_us;
+    int64_t rewrite_max_us;  // Shows garbage collection stalls
+    uint32_t read_kib_s;
+} bench_result_t;
+
+static char bench_buf[4096];
+
+/* Rewrite a small file BENCH_REWRITES times, as settings saves did with
+config.json, then read the larger chime through, on the filesystem mounted
+at `base`. */
+static void bench_files(const char* base, bench_result_t* r) {
+    char path[VFS_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", base, BENCH_FILE);
+    memset(bench_buf, 'x', BENCH_FILE_SIZE);
+
+    int64_t total = 0;
+    for (int i = 0; i < BENCH_REWRITES; i++) {
+        int64_t start = esp_timer_get_time();
+        FILE* f = fopen(path, "w");
+        if (f == NULL) return;
+        fwrite(bench_buf, 1, BENCH_FILE_SIZE, f);
+        fclose(f);
+        int64_t us = esp_timer_get_time() - start;
+        total += us;
+        if (us > r->rewrite_max_us) r->rewrite_max_us = us;
+    }
+    unlink(path);
+    r->rewrite_avg_us = total / BENCH_REWRITES;
+
+    snprintf(path, sizeof(path), "%s/%s", base, BENCH_MP3);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return;
+    setvbuf(f, NULL, _IONBF, 0);
+    int64_t start = esp_timer_get_time();
+    size_t bytes = 0, n;
+    while ((n = fread(bench_buf, 1, sizeof(bench_buf), f)) > 0) bytes += n;
+    int64_t us = esp_timer_get_time() - start;
+    fclose(f);
+    if (us > 0) r->read_kib_s = (uint64_t)bytes * 1000000 / 1024 / us;
+}
+
+static void log_result(const char* fs, const bench_result_t* r) {
+    ESP_LOGI(TAG,
+             "%s: mount %lld us, %d byte rewrite %lld us (max %lld us), "
+             "%s read at %u KiB/s",
+             fs, r->mount_us, BENCH_FILE_SIZE, r->rewrite_avg_us,
+             r->rewrite_max_us, BENCH_MP3, (unsigned int)r->read_kib_s);
+}
+
+/* Remount LittleFS and mount the SPIFFS partition aside, timing both, and
+run bench_files on each. */
+static esp_err_t vfs_benchmark(void) {
+    bench_result_t littlefs = {0}, spiffs = {0};
+
+    esp_vfs_littlefs_unregister(littlefs_conf.partition_label);
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = mount_littlefs();
+    if (ret != ESP_OK) return ret;
+    littlefs.mount_us = esp_timer_get_time() - start;
+    bench_files(VFS_BASE_PATH, &littlefs);
+    log_result("LittleFS", &littlefs);
+
+    start = esp_timer_get_time();
+    if (mount_spiffs_aside() != ESP_OK) {
+        ESP_LOGI(TAG, "No SPIFFS partition to compare with");
+        return ESP_OK;
+    }
+    spiffs.mount_us = esp_timer_get_time() - start;
+    bench_files(SPIFFS_SIDE_PATH, &spiffs);
+    esp_vfs_spiffs_unregister(conf.partition_label);
+    log_result("SPIFFS", &spiffs);
+    return ESP_OK;
+}
+#endif
+#endif
+
+/* Mount the filesystem chosen in CONFIG_VFS_BACKEND at VFS_BASE_PATH */
+esp_err_t vfs_init(void) {
+    int64_t start = esp_timer_get_time();
+#if CONFIG_VFS_LITTLEFS
+    if (mount_littlefs() != ESP_OK) return ESP_FAIL;
+    ESP_LOGI(TAG, "LittleFS mounted in %lld us", esp_timer_get_time() - start);
+    migrate();
+#if CONFIG_VFS_BENCHMARK
+    return vfs_benchmark();
+#endif
+    return ESP_OK;
+#else
+    esp_err_t ret = mount_spiffs();
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "SPIFFS mounted in %lld us",
+                 esp_timer_get_time() - start);
+    }
+    return ret;
+#endif
+}
 
 /* Unregister vfs */
 esp_err_t vfs_unregister(void) {
+#if CONFIG_VFS_LITTLEFS
+    esp_vfs_littlefs_unregister(littlefs_conf.partition_label);
+    ESP_LOGI(TAG, "LittleFS unmounted");
+#else
     // All done, unmount partition and disable SPIFFS
     esp_vfs_spiffs_unregister(conf.partition_label);
     ESP_LOGI(TAG, "SPIFFS unmounted");
+#endif
 
     return ESP_OK;
 }
+
+/* Bytes in the filesystem and in use */
+esp_err_t vfs_usage(size_t* total, size_t* used) {
+#if CONFIG_VFS_LITTLEFS
+    return esp_littlefs_info(littlefs_conf.partition_label, total, used);
+#else
+    return esp_spiffs_info(conf.partition_label, total, used);
+#endif
+}
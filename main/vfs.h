@@ -5,5 +5,6 @@
 
 esp_err_t vfs_init(void);
 esp_err_t vfs_unregister(void);
+esp_err_t vfs_usage(size_t* total, size_t* used);
 
 #endif /* VFS_H */
@@ -0,0 +1,165 @@
+#include "wallclock.h"
+
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "static_alloc.h"
+#include "tz.h"
+
+#define SECS_PER_DAY 86400
+#define BENCH_SECONDS 1000
+
+static const char* TAG = "wallclock";
+
+static SemaphoreHandle_t lock = NULL;
+
+// Last time handed out and its decomposition
+static time_t cur_t = 0;
+static struct tm cur_tm;
+
+// Span in which cur_tm can be advanced by carry: [span_from, span_until).
+// It belongs to one generation; wallclock_invalidate() starts a new one.
+static volatile uint32_t generation = 1;
+static uint32_t span_generation = 0;
+static uint32_t span_tz_generation = 0;
+static time_t span_from = 0;
+static time_t span_until = 0;
+
+static uint32_t resyncs = 0;
+
+static int32_t second_of_day(const struct tm* tm) {
+    return tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+static void resync(time_t t) {
+    uint32_t gen = generation;
+    uint32_t tz_gen = tz_generation();
+    tz_span_t offset_span;
+    tz_localtime(t, &cur_tm, &offset_span);
+    cur_t = t;
+
+    span_from = t;
+    span_until = t - second_of_day(&cur_tm) + SECS_PER_DAY;  // Local midnight
+    if (offset_span.until < span_until) {
+        span_until = offset_span.until;
+        ESP_LOGI(TAG, "UTC offset changes at %lld", (long long)span_until);
+    }
+    span_generation = gen;
+    span_tz_generation = tz_gen;
+    resyncs++;
+}
+
+/* Move cur_tm to `t`, which lies in the current span. One second forward is
+the common case and is a plain carry; anything else within the day is a
+divide of the second of the day. */
+static void advance(time_t t) {
+    if (t == cur_t + 1) {
+        if (++cur_tm.tm_sec == 60) {
+            cur_tm.tm_sec = 0;
+            if (++cur_tm.tm_min == 60) {
+                cur_tm.tm_min = 0;
+                cur_tm.tm_hour++;  // Never reaches 24: midnight ends the span
+            }
+        }
+    } else if (t != cur_t) {
+        int32_t sod = second_of_day(&cur_tm) + (int32_t)(t - cur_t);
+        cur_tm.tm_hour = sod / 3600;
+        cur_tm.tm_min = (sod / 60) % 60;
+        cur_tm.tm_sec = sod % 60;
+    }
+    cur_t = t;
+}
+
+void wallclock_init(void) {
+    lock = MUTEX_CREATE();
+#if CONFIG_WALLCLOCK_BENCHMARK
+    wallclock_benchmark();
+#endif
+}
+
+/* Drop the current span, e.g. after the clock was stepped or the time zone
+changed. Lock-free, so it is safe from any task and even before
+wallclock_init(). */
+void wallclock_invalidate(void) {
+    generation++;
+}
+
+void wallclock_at(time_t t, struct tm* out) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (span_generation == generation &&
+        span_tz_generation == tz_generation() && t >= span_from &&
+        t < span_until) {
+        advance(t);
+    } else {
+        resync(t);
+    }
+    *out = cur_tm;
+    xSemaphoreGive(lock);
+}
+
+time_t wallclock_now(struct tm* out) {
+    time_t now;
+    time(&now);
+    wallclock_at(now, out);
+    return now;
+}
+
+/* First top of the hour after `t` that the display will actually show. A
+UTC offset change on the way skips or repeats part of an hour (half of one
+in some zones), so past a change the top is found again in the new offset. */
+time_t wallclock_next_hour(time_t t) {
+    struct tm tm;
+    tz_span_t span;
+    tz_localtime(t, &tm, &span);
+    time_t next = t + 3600 - (tm.tm_min * 60 + tm.tm_sec);
+
+    while (next >= span.until) {
+        time_t from = span.until;
+        tz_localtime(from, &tm, &span);
+        int into_hour = tm.tm_min * 60 + tm.tm_sec;
+        next = from + (into_hour == 0 ? 0 : 3600 - into_hour);
+    }
+    return next;
+}
+
+/* Decompose BENCH_SECONDS consecutive seconds with libc, with the compiled
+time zone table and incrementally, and log the cycles per second of time. */
+void wallclock_benchmark(void) {
+    time_t start;
+    time(&start);
+    struct tm tm;
+
+    uint32_t c0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_SECONDS; i++) {
+        time_t t = start + i;
+        localtime_r(&t, &tm);
+    }
+    uint32_t libc_cycles = esp_cpu_get_cycle_count() - c0;
+
+    c0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_SECONDS; i++) {
+        tz_localtime(start + i, &tm, NULL);
+    }
+    uint32_t table_cycles = esp_cpu_get_cycle_count() - c0;
+
+    wallclock_invalidate();
+    uint32_t resyncs_before = resyncs;
+    c0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_SECONDS; i++) {
+        wallclock_at(start + i, &tm);
+    }
+    uint32_t engine_cycles = esp_cpu_get_cycle_count() - c0;
+    wallclock_invalidate();
+
+    ESP_LOGI(TAG,
+             "Benchmark: localtime_r %u cycles/s, TZ table %u cycles/s, "
+             "incremental %u cycles/s (%u resyncs over %d s)",
+             (unsigned int)(libc_cycles / BENCH_SECONDS),
+             (unsigned int)(table_cycles / BENCH_SECONDS),
+             (unsigned int)(engine_cycles / BENCH_SECONDS),
+             (unsigned int)(resyncs - resyncs_before), BENCH_SECONDS);
+}
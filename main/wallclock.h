@@ -0,0 +1,19 @@
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <time.h>
+
+/* Shared wall-clock calendar. The time is decomposed through the time zone
+table once and then advanced by carry within a span that is known to have a
+constant UTC offset: up to the next local midnight or offset (DST)
+transition, whichever comes first. Anything outside the span, any query
+after wallclock_invalidate() and any after a time zone change resynchronise
+from the table. */
+void wallclock_init(void);
+void wallclock_invalidate(void);
+void wallclock_at(time_t t, struct tm* out);
+time_t wallclock_now(struct tm* out);
+time_t wallclock_next_hour(time_t t);
+void wallclock_benchmark(void);
+
+#endif /* WALLCLOCK_H */
@@ -13,6 +13,7 @@
 #include <wifi_provisioning/scheme_ble.h>
 
 #include "config.h"
+#include "settings.h"
 
 // FreeRTOS event group to signal when we are connected
 static EventGroupHandle_t wifi_event_group;
@@ -194,6 +195,19 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+// Keep new Wi-Fi credentials in the settings and in NVS
+static void save_credentials(const char* ssid, const char* password) {
+    settings_t settings;
+    settings_get(&settings);
+    // At most 32 and 64 bytes, with no terminator at full length
+    strncpy(settings.wifi.ssid, ssid, 32);
+    strncpy(settings.wifi.pass, password, 64);
+    settings_update(&settings);
+    // Written at once, the device may be unplugged right after provisioning
+    settings_save();
+    settings_flush();
+}
+
 // Event handler for catching system events for the provisioning manager
 static void prov_event_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data) {
@@ -213,9 +227,8 @@ static void prov_event_handler(void* arg, esp_event_base_t event_base,
                          "\n\tSSID     : %s\n\tPassword : %s",
                          (const char*)wifi_sta_cfg->ssid,
                          (const char*)wifi_sta_cfg->password);
-                // Write new WIFI credentials to the config
-                write_config_value("ssid", (const char*)wifi_sta_cfg->ssid);
-                write_config_value("pass", (const char*)wifi_sta_cfg->password);
+                save_credentials((const char*)wifi_sta_cfg->ssid,
+                                 (const char*)wifi_sta_cfg->password);
                 break;
             }
             case WIFI_PROV_CRED_FAIL: {
@@ -306,14 +319,14 @@ static void initialise_mdns(void) {
 
 // Check current WIFI configuration with current WIFI config
 void check_and_update_wifi_config(wifi_config_t* current_config) {
-    char ssid[32];
-    char password[64];
     char prev_ssid[32];
     char prev_password[64];
 
-    // Read WIFI configuration
-    read_config_value("ssid", ssid, sizeof(ssid));
-    read_config_value("pass", password, sizeof(password));
+    // WIFI configuration from the settings
+    settings_t settings;
+    settings_get(&settings);
+    const char* ssid = settings.wifi.ssid;
+    const char* password = settings.wifi.pass;
 
     // Copy current SSID and password to previous config variables
     strncpy(prev_ssid, (char*)current_config->sta.ssid, sizeof(prev_ssid));
@@ -323,14 +336,6 @@ void check_and_update_wifi_config(wifi_config_t* current_config) {
     ESP_LOGI(TAG, "Previous SSID: %s", prev_ssid);
     ESP_LOGI(TAG, "Previous password: %s", prev_password);
 
-    char* data = read_json_data();
-    if (data == NULL) {
-        printf("Error: Failed to read JSON data.\n");
-    } else {
-        printf("JSON data: %s\n", data);
-        free(data);
-    }
-
     // Update WIFI configuration
     if ((strncmp(ssid, prev_ssid, 32) != 0 ||
          strncmp(password, prev_password, 64) != 0) &&
@@ -4,30 +4,37 @@
 #include <driver/gpio.h>
 #include <esp_http_server.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_system.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <sdkconfig.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
 
+#include "cathode.h"
 #include "clock.h"
-#include "config.h"
+#include "display.h"
 #include "esp_heap_caps.h"
+#include "json_arena.h"
 #include "leds.h"
+#include "metrics.h"
+#include "settings.h"
+#include "sntp.h"
+#include "trace.h"
 #include "vfs.h"
 
 static const char* TAG = "server";
 
-static const char html_header[] =
-    "<!DOCTYPE html><html><head><meta charset=\"UTF-8\">"
-    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0, "
-    "maximum-scale=1, user-scalable=0\">"
-    "<title>Wi-Fi Nixie Clock</title>"
-    "<style>";
+// Fits the ETag pack_page.py computes, and a few for If-None-Match
+#define ETAG_MATCH_LEN 128
+// Browsers send a few dozen bytes, e.g. "gzip, deflate, br, zstd"
+#define ACCEPT_ENCODING_LEN 128
 
 static esp_err_t favicon_get_handler(httpd_req_t* req) {
     extern const unsigned char favicon_ico_start[] asm(
@@ -39,32 +46,67 @@ static esp_err_t favicon_get_handler(httpd_req_t* req) {
     return ESP_OK;
 }
 
+/* Whether the client takes a gzip body: Accept-Encoding lists gzip (or its
+alias x-gzip) or * without q=0, or is absent, which means any encoding will
+do. A header too long for the buffer is given the benefit of the doubt. */
+static bool accepts_gzip(httpd_req_t* req) {
+    char accept[ACCEPT_ENCODING_LEN];
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept,
+                                                sizeof(accept));
+    if (err == ESP_ERR_NOT_FOUND) return true;
+    if (err != ESP_OK) return err == ESP_ERR_HTTPD_RESULT_TRUNC;
+
+    for (char* save = NULL, *item = strtok_r(accept, ",", &save);
+         item != NULL; item = strtok_r(NULL, ",", &save)) {
+        item += strspn(item, " \t");
+        size_t name_len = strcspn(item, " \t;");
+        bool named = (name_len == 4 && strncasecmp(item, "gzip", 4) == 0) ||
+                     (name_len == 6 && strncasecmp(item, "x-gzip", 6) == 0) ||
+                     (name_len == 1 && item[0] == '*');
+        if (!named) continue;
+
+        // Only an explicit zero weight (q=0, q=0.0, ...) refuses it
+        char* q = strstr(item, "q=");
+        if (q == NULL || strtod(q + 2, NULL) > 0) return true;
+    }
+    return false;
+}
+
+/* The web UI, packed into one gzipped page at build time by pack_page.py.
+Browsers revalidate it on every load and get a bodiless 304 while the
+firmware is unchanged. */
 static esp_err_t root_get_handler(httpd_req_t* req) {
-    httpd_resp_sendstr_chunk(req, html_header);
-    extern const unsigned char css_start[] asm("_binary_styles_css_start");
-    extern const unsigned char css_end[] asm("_binary_styles_css_end");
-    httpd_resp_send_chunk(req, (const char*)css_start, (css_end - css_start));
-
-    httpd_resp_sendstr_chunk(req, "</style><script>");
-    extern const unsigned char iro_start[] asm("_binary_iro_min_js_start");
-    extern const unsigned char iro_end[] asm("_binary_iro_min_js_end");
-    httpd_resp_send_chunk(req, (const char*)iro_start, (iro_end - iro_start));
-
-    httpd_resp_sendstr_chunk(req, "</script><script>");
-    extern const unsigned char settings_start[] asm(
-        "_binary_settings_js_start");
-    extern const unsigned char settings_end[] asm("_binary_settings_js_end");
-    httpd_resp_send_chunk(req, (const char*)settings_start,
-                          (settings_end - settings_start));
-
-    httpd_resp_sendstr_chunk(req, "</script></head>");
-    extern const unsigned char body_start[] asm("_binary_body_html_start");
-    extern const unsigned char body_end[] asm("_binary_body_html_end");
-    httpd_resp_send_chunk(req, (const char*)body_start,
-                          (body_end - body_start));
-
-    httpd_resp_sendstr_chunk(req, "</html>");
-    httpd_resp_sendstr_chunk(req, NULL);
+    extern const unsigned char page_start[] asm("_binary_page_html_gz_start");
+    extern const unsigned char page_end[] asm("_binary_page_html_gz_end");
+    extern const char page_etag[] asm("_binary_page_etag_start");
+
+    httpd_resp_set_hdr(req, "ETag", page_etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    // The one representation is gzip, so caches must key on the encoding
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    char match[ETAG_MATCH_LEN];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", match,
+                                    sizeof(match)) == ESP_OK &&
+        (strstr(match, page_etag) != NULL || strcmp(match, "*") == 0)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    /* There is no uncompressed copy in flash to fall back on, and keeping
+    one would cost more than the page itself; a client that refuses gzip
+    is told so rather than sent bytes it cannot read. */
+    if (!accepts_gzip(req)) {
+        httpd_resp_set_status(req, "406 Not Acceptable");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_sendstr(req, "The page is only available gzip-encoded");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "text/html");
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_send(req, (const char*)page_start, page_end - page_start);
     return ESP_OK;
 }
 
@@ -95,137 +137,77 @@ static esp_err_t color_picker_handler(httpd_req_t* req) {
     return ESP_OK;
 }
 
+/* Decode the body as it arrives, into a copy of the settings that only
+replaces them once all of it has parsed, so no body size needs a buffer. */
 static esp_err_t jSON_post_handler(httpd_req_t* req) {
     char buf[256];
-    int total_len = req->content_len;
-    int remaining_len = total_len;
-    char* data = (char*)malloc(total_len + 1);
-    if (!data) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
+    int remaining_len = req->content_len;
+
+    settings_t settings;
+    settings_get(&settings);
+    json_stream_t js;
+    settings_decoder_init(&js, &settings);
 
-    int received = 0;
     while (remaining_len > 0) {
         int ret = httpd_req_recv(req, buf, MIN(remaining_len, sizeof(buf)));
         if (ret <= 0) {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) continue;
-            free(data);
             httpd_resp_send_500(req);
             return ESP_FAIL;
         }
-        memcpy(data + received, buf, ret);
+        if (json_stream_feed(&js, buf, ret) != ESP_OK) break;
         remaining_len -= ret;
-        received += ret;
     }
-    data[received] = '\0';
-
-    cJSON* json = cJSON_Parse(data);
-    if (json == NULL) {
-        free(data);
+    if (remaining_len > 0 || json_stream_finish(&js) != ESP_OK) {
+        ESP_LOGW(TAG, "Invalid JSON near byte %u", (unsigned int)js.pos);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    // --- RAM SYNC START ---
-    // Perform this BEFORE opening the file to avoid any I/O lag
-    cJSON* time_fmt = cJSON_GetObjectItem(json, "time_fmt");
-    if (cJSON_IsString(time_fmt)) {
-        clock_set_ram_format(atoi(time_fmt->valuestring));
-    }
-    cJSON* mode_item = cJSON_GetObjectItem(json, "led_mode");
-    if (cJSON_IsString(mode_item)) {
-        led_set_ram_mode(mode_item->valuestring);
+    // The subscribers of what changed bring the hardware in line
+    if ((settings_update(&settings) & SETTINGS_LED) == 0) {
+        // Still drop any LED preview the form did not keep
+        settings_refresh(SETTINGS_LED);
     }
 
-    cJSON* color = cJSON_GetObjectItem(json, "color");
-    if (color) {
-        int r = cJSON_GetObjectItem(color, "r")->valueint;
-        int g = cJSON_GetObjectItem(color, "g")->valueint;
-        int b = cJSON_GetObjectItem(color, "b")->valueint;
-        led_set_ram_color((uint8_t)r, (uint8_t)g, (uint8_t)b);
-    }
-    // --- RAM SYNC END ---
+    // Written by the save task once the edits stop
+    settings_save();
 
-    // Now handle the persistent storage
-    FILE* f = fopen(CONFIG_FILENAME, "w");
-    if (f == NULL) {
-        cJSON_Delete(json);
-        free(data);
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* Send `json` and free it. A tree that lost parts when the request's arena
+ran out is answered with 500, even if the printed text still fit. */
+static esp_err_t send_json(httpd_req_t* req, cJSON* json) {
+    char* data = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (data == NULL || json_arena_overflowed()) {
+        cJSON_free(data);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    char* jsonString = cJSON_Print(json);
-    if (jsonString) {
-        fwrite(jsonString, 1, strlen(jsonString), f);
-        free(jsonString);
-    }
-
-    fclose(f);  // Close the file as soon as possible
-    cJSON_Delete(json);
-    free(data);
-
-    // Final kick to ensure hardware is in sync with the new RAM values
-    led_send_msg(LED_CMD_RELOAD_CONFIG, 0, 0, 0);
-
-    httpd_resp_send(req, NULL, 0);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, data, strlen(data));
+    cJSON_free(data);
     return ESP_OK;
 }
 
 static esp_err_t jSON_get_handler(httpd_req_t* req) {
-    // Read the raw JSON string from the Flash/NVS
-    char* data = read_json_data();
-    if (data == NULL) {
-        httpd_resp_send_404(req);
-        return ESP_OK;
-    }
-
-    // Parse the data to update RAM variables
-    // This ensures RAM "snaps back" to Disk state on browser refresh
-    cJSON* json = cJSON_Parse(data);
-    if (json) {
-        // Sync LED Mode
-        cJSON* mode_item = cJSON_GetObjectItem(json, "led_mode");
-        if (cJSON_IsString(mode_item)) {
-            led_set_ram_mode(mode_item->valuestring);
-        }
-
-        // Sync RGB Colors
-        cJSON* color = cJSON_GetObjectItem(json, "color");
-        if (color) {
-            cJSON* r = cJSON_GetObjectItem(color, "r");
-            cJSON* g = cJSON_GetObjectItem(color, "g");
-            cJSON* b = cJSON_GetObjectItem(color, "b");
-            if (r && g && b) {
-                led_set_ram_color((uint8_t)r->valueint, (uint8_t)g->valueint,
-                                  (uint8_t)b->valueint);
-            }
-        }
-
-        // Sync Clock Time Format (12h/24h)
-        cJSON* time_fmt = cJSON_GetObjectItem(json, "time_fmt");
-        if (cJSON_IsString(time_fmt)) {
-            clock_set_ram_format(atoi(time_fmt->valuestring));
-        }
+    settings_t settings;
+    settings_get(&settings);
+    cJSON* json = settings_to_json(&settings);
 
-        cJSON_Delete(json);
-
-        // Final kick to the LED task to apply the colors we just synced
-        led_send_msg(LED_CMD_RELOAD_CONFIG, 0, 0, 0);
-    }
+    // The page shows the saved LED settings, so unsaved previews snap back
+    settings_refresh(SETTINGS_LED);
 
-    // Send the JSON to the browser UI
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, data, strlen(data));
-
-    // Clean up the allocated string buffer
-    free(data);
-    return ESP_OK;
+    return send_json(req, json);
 }
 
 static esp_err_t jSON_reboot_handler(httpd_req_t* req) {
     httpd_resp_send(req, "Rebooting...", 12);
+    settings_flush();
     vfs_unregister();
     vTaskDelay(pdMS_TO_TICKS(500));
 
@@ -265,6 +247,79 @@ static esp_err_t led_mode_handler(httpd_req_t* req) {
     return ESP_OK;
 }
 
+/* /chrono?cmd=stopwatch|countdown|start|stop|reset|exit[&secs=N] */
+static esp_err_t chrono_handler(httpd_req_t* req) {
+    char query[64];
+    char param[16];
+    chrono_cmd_t cmd;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "cmd", param, sizeof(param)) != ESP_OK ||
+        !chrono_cmd_from_string(param, &cmd)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad chrono command");
+        return ESP_FAIL;
+    }
+
+    uint32_t secs = 0;
+    if (httpd_query_key_value(query, "secs", param, sizeof(param)) == ESP_OK) {
+        secs = strtoul(param, NULL, 10);
+    }
+
+    ESP_LOGI(TAG, "Chrono command: %s", query);
+    clock_send_chrono(cmd, secs);
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
+
+static esp_err_t cathode_get_handler(httpd_req_t* req) {
+    uint32_t on_s[DISPLAY_TUBES][CATHODE_DIGITS];
+    cathode_get_on_time(on_s);
+
+    // {"on_s": [[tube 0, digits 0-9], ..., [tube 5, digits 0-9]]}
+    cJSON* json = cJSON_CreateObject();
+    cJSON* tubes = cJSON_AddArrayToObject(json, "on_s");
+    for (int t = 0; t < DISPLAY_TUBES; t++) {
+        cJSON* digits = cJSON_CreateArray();
+        for (int d = 0; d < CATHODE_DIGITS; d++) {
+            cJSON_AddItemToArray(digits, cJSON_CreateNumber(on_s[t][d]));
+        }
+        cJSON_AddItemToArray(tubes, digits);
+    }
+
+    return send_json(req, json);
+}
+
+static esp_err_t ntp_get_handler(httpd_req_t* req) {
+    sntp_stats_t stats;
+    sntp_get_stats(&stats);
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddBoolToObject(json, "synced", stats.synced);
+    cJSON_AddNumberToObject(json, "offset_us", stats.offset_us);
+    cJSON_AddNumberToObject(json, "delay_us", stats.delay_us);
+    cJSON_AddNumberToObject(json, "jitter_us", stats.jitter_us);
+    cJSON_AddNumberToObject(json, "drift_ppm", stats.drift_ppb / 1000.0);
+    cJSON_AddNumberToObject(json, "poll_s", stats.poll_s);
+    cJSON_AddNumberToObject(json, "last_sync_age_s", stats.last_sync_age_s);
+    cJSON_AddNumberToObject(json, "polls", stats.polls);
+    cJSON_AddNumberToObject(json, "failures", stats.failures);
+    cJSON_AddNumberToObject(json, "steps", stats.steps);
+    cJSON* servers = cJSON_AddArrayToObject(json, "servers");
+    for (int i = 0; i < stats.server_count; i++) {
+        cJSON* server = cJSON_CreateObject();
+        cJSON_AddStringToObject(server, "name", stats.servers[i].name);
+        cJSON_AddNumberToObject(server, "reach", stats.servers[i].reach);
+        cJSON_AddNumberToObject(server, "delay_us", stats.servers[i].delay_us);
+        cJSON_AddBoolToObject(server, "current", i == stats.current_server);
+        cJSON_AddItemToArray(servers, server);
+    }
+
+    return send_json(req, json);
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t* req);
+static esp_err_t trace_get_handler(httpd_req_t* req);
+
 static const httpd_uri_t favicon = {
     .uri = "/favicon.ico", .method = HTTP_GET, .handler = favicon_get_handler};
 static const httpd_uri_t root = {
@@ -279,20 +334,65 @@ static const httpd_uri_t reboot = {
     .uri = "/reboot", .method = HTTP_POST, .handler = jSON_reboot_handler};
 static const httpd_uri_t mode_uri = {
     .uri = "/led_mode", .method = HTTP_GET, .handler = led_mode_handler};
+static const httpd_uri_t chrono_uri = {
+    .uri = "/chrono", .method = HTTP_GET, .handler = chrono_handler};
+static const httpd_uri_t cathode_uri = {
+    .uri = "/cathodes", .method = HTTP_GET, .handler = cathode_get_handler};
+static const httpd_uri_t ntp_uri = {
+    .uri = "/ntp", .method = HTTP_GET, .handler = ntp_get_handler};
+
+static const httpd_uri_t metrics_uri = {
+    .uri = "/metrics", .method = HTTP_GET, .handler = metrics_get_handler};
+
+static const httpd_uri_t trace_uri = {
+    .uri = "/trace", .method = HTTP_GET, .handler = trace_get_handler};
+
+static const httpd_uri_t* const endpoints[] = {
+    &favicon,  &root,        &picker,     &update,  &data_uri,    &reboot,
+    &mode_uri, &cathode_uri, &chrono_uri, &ntp_uri, &metrics_uri, &trace_uri};
+#define ENDPOINT_COUNT (sizeof(endpoints) / sizeof(endpoints[0]))
+
+// Request latency per endpoint, in the order of endpoints[]
+static metrics_hist_t latency[ENDPOINT_COUNT];
+
+/* Every endpoint is registered through this, with its histogram as the user
+context, to time the handler and give it a fresh cJSON arena. */
+static esp_err_t timed_handler(httpd_req_t* req) {
+    metrics_hist_t* hist = req->user_ctx;
+    const httpd_uri_t* uri = endpoints[hist - latency];
+
+    int64_t start = esp_timer_get_time();
+    TRACE_BEGIN(uri->uri);
+    json_arena_begin();
+    esp_err_t ret = uri->handler(req);
+    json_arena_end();
+    TRACE_END(uri->uri);
+    metrics_observe(hist, esp_timer_get_time() - start);
+    return ret;
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t* req) {
+    return metrics_send(req, latency, ENDPOINT_COUNT);
+}
+
+static esp_err_t trace_get_handler(httpd_req_t* req) {
+    return trace_send(req);
+}
 
 esp_err_t start_webserver(void) {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     // config.stack_size = 8192;
+    config.max_uri_handlers = 16;
 
     if (httpd_start(&server, &config) == ESP_OK) {
-        httpd_register_uri_handler(server, &favicon);
-        httpd_register_uri_handler(server, &root);
-        httpd_register_uri_handler(server, &picker);
-        httpd_register_uri_handler(server, &update);
-        httpd_register_uri_handler(server, &data_uri);
-        httpd_register_uri_handler(server, &reboot);
-        httpd_register_uri_handler(server, &mode_uri);
+        for (size_t i = 0; i < ENDPOINT_COUNT; i++) {
+            httpd_uri_t uri = *endpoints[i];
+            uri.handler = timed_handler;
+            uri.user_ctx = &latency[i];
+            latency[i].name = uri.uri;
+            httpd_register_uri_handler(server, &uri);
+        }
         return ESP_OK;
     }
     return ESP_FAIL;